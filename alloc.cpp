@@ -0,0 +1,141 @@
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/mman.h>
+
+#include "alloc.hpp"
+
+static page_policy policy = PAGES_TRANSPARENT;
+static size_t huge_threshold = 2 << 20;
+
+const size_t HUGE_PAGE = 2 << 20;
+
+enum alloc_kind : u32 { KIND_HEAP, KIND_THP, KIND_HUGETLB };
+
+// In front of every allocation, padded to ALLOC_ALIGN so the memory after
+// it stays aligned.
+struct alloc_header {
+    size_t bytes;   // mapped, header included
+    alloc_kind kind;
+};
+
+static_assert(sizeof(alloc_header) <= ALLOC_ALIGN, "header must fit the alignment");
+
+page_policy current_page_policy()
+{
+    return policy;
+}
+
+void set_page_policy(page_policy p, size_t threshold)
+{
+    policy = p;
+    huge_threshold = threshold;
+}
+
+const char* page_policy_name(page_policy p)
+{
+    switch (p) {
+        case PAGES_SMALL: return "small";
+        case PAGES_TRANSPARENT: return "thp";
+        case PAGES_HUGETLB: return "hugetlb";
+    }
+    return "?";
+}
+
+static void* map_pages(size_t bytes, alloc_kind* kind)
+{
+#ifdef MAP_HUGETLB
+    if (policy == PAGES_HUGETLB) {
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            *kind = KIND_HUGETLB;
+            return p;
+        }
+    }
+#endif
+
+    // over-mapped by a huge page and trimmed to start on one, otherwise the
+    // first and last 2 MB of the range straddle huge page boundaries and
+    // stay on small pages
+    u8* base = (u8*)mmap(nullptr, bytes + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return nullptr;
+    u8* p = (u8*)(((uintptr_t)base + HUGE_PAGE - 1) & ~(uintptr_t)(HUGE_PAGE - 1));
+    if (p > base) munmap(base, p - base);
+    if (base + HUGE_PAGE > p) munmap(p + bytes, base + HUGE_PAGE - p);
+#ifdef MADV_HUGEPAGE
+    madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+    *kind = KIND_THP;
+    return p;
+}
+
+void* alloc_bytes(size_t n)
+{
+    n += ALLOC_ALIGN;
+
+    void* p = nullptr;
+    alloc_kind kind = KIND_HEAP;
+    if (policy != PAGES_SMALL && n >= huge_threshold) {
+        n = (n + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+        p = map_pages(n, &kind);
+    }
+    if (!p) {
+        kind = KIND_HEAP;
+        if (posix_memalign(&p, ALLOC_ALIGN, n)) return nullptr;
+    }
+
+    alloc_header* h = (alloc_header*)p;
+    h->bytes = n;
+    h->kind = kind;
+    return (u8*)p + ALLOC_ALIGN;
+}
+
+void free_bytes(void* p)
+{
+    if (!p) return;
+
+    alloc_header* h = (alloc_header*)((u8*)p - ALLOC_ALIGN);
+    if (h->kind == KIND_HEAP) {
+        free(h);
+    } else {
+        munmap(h, h->bytes);
+    }
+}
+
+// AnonHugePages of the mapping that starts at p, in kB, or -1 when
+// /proc/self/smaps can't be read.
+static long anon_huge_kb(const void* p)
+{
+    FILE* f = fopen("/proc/self/smaps", "re");
+    if (!f) return -1;
+
+    long kb = -1;
+    b32 inside = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long start, end, value;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            if (inside) break;
+            inside = start <= (uintptr_t)p && (uintptr_t)p < end;
+        } else if (inside && sscanf(line, "AnonHugePages: %lu kB", &value) == 1) {
+            kb = value;
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+const char* pages_of(const void* p)
+{
+    const alloc_header* h = (const alloc_header*)((const u8*)p - ALLOC_ALIGN);
+    switch (h->kind) {
+        case KIND_HEAP: return "heap";
+        case KIND_HUGETLB: return "hugetlb";
+        case KIND_THP: {
+            const long kb = anon_huge_kb(h);
+            return kb < 0 ? "thp?" : kb > 0 ? "thp" : "small";
+        }
+    }
+    return "?";
+}
@@ -0,0 +1,52 @@
+#ifndef ALLOC_HPP
+#define ALLOC_HPP
+
+// Memory for buffers: 64-byte aligned, and for large buffers backed by
+// huge pages when the policy asks for them, so the column passes over an
+// image don't take a TLB miss every few rows.
+
+#include <cassert>
+#include <cstddef>
+
+#include "types.hpp"
+
+enum page_policy {
+    PAGES_SMALL,        // aligned heap memory
+    PAGES_TRANSPARENT,  // madvise(MADV_HUGEPAGE), the kernel may use huge pages
+    PAGES_HUGETLB,      // MAP_HUGETLB, transparent when none are reserved
+};
+
+const u32 ALLOC_ALIGN = 64;
+
+// Policy for buffers of at least threshold bytes, smaller ones always
+// come from the heap. Defaults to PAGES_TRANSPARENT above 2 MB. Meant to
+// be set once at startup, or by benchmarks.
+page_policy current_page_policy();
+void set_page_policy(page_policy policy, size_t threshold = 2 << 20);
+const char* page_policy_name(page_policy policy);
+
+// ALLOC_ALIGN aligned memory of at least n bytes, freed with free_bytes.
+// Returns nullptr when there is none.
+void* alloc_bytes(size_t n);
+void free_bytes(void* p);
+
+// What the memory at p, from alloc_bytes, is on: "heap", "hugetlb" for a
+// MAP_HUGETLB mapping, and for a mapping advised for transparent huge
+// pages "thp" when /proc/self/smaps shows the kernel gave it some, "small"
+// when it gave none and "thp?" when smaps can't be read. Only touched
+// memory counts; reads smaps, so not for hot paths.
+const char* pages_of(const void* p);
+
+// Pitch in elements of `size` bytes for rows of n elements: rows start
+// on ALLOC_ALIGN, and get one ALLOC_ALIGN more when they would be a
+// multiple of 4 KB apart, where the rows of a column all fall into the
+// same cache set. size has to divide ALLOC_ALIGN.
+inline u32 padded_pitch(u32 n, u32 size)
+{
+    assert(ALLOC_ALIGN % size == 0);
+    u32 bytes = (n * size + ALLOC_ALIGN - 1) / ALLOC_ALIGN * ALLOC_ALIGN;
+    if (bytes % 4096 == 0) bytes += ALLOC_ALIGN;
+    return bytes / size;
+}
+
+#endif
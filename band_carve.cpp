@@ -0,0 +1,369 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cctype>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "band_carve.hpp"
+#include "carve.hpp"
+
+// Each seam is one sweep down the image: a band is read, the previous
+// seam is taken out of it, it is written back, and the costs of its rows
+// go on from the last row of the band above. The working image is kept
+// without padding, so the sweeps read and write less as it narrows. The
+// cost rows at the band boundaries are all the sweep carries over, the
+// choices are what it spills; tracing a seam needs no image rows.
+
+// Rows of `pitch` bytes from offset on in fd.
+struct band_file {
+    int fd;
+    u64 offset;
+    u32 pitch;
+};
+
+struct band_files {
+    int in = -1, out = -1, work = -1, spill = -1;
+
+    ~band_files() {
+        for (int fd : {in, out, work, spill}) {
+            if (fd >= 0) close(fd);
+        }
+    }
+};
+
+struct band_carver {
+    u32 w, h, s;            // width the current sweep leaves
+    u32 rows;               // rows per band
+    buffer<u8> band;        // two rows above the band, then the band
+    buffer<u8> choices;     // packed choices of the rows one band finishes
+    buffer<f32> costs;      // previous and current cost row, energies
+    buffer<u8> c;
+    std::vector<u32> xs;    // the seam taken out by the next sweep
+    int spill;
+    b32 checkpoints;        // cost rows spilled instead of choices
+    band_report report;
+};
+
+// Both return 0 on success.
+static int pread_full(int fd, void* data, size_t size, u64 offset)
+{
+    char* p = (char*)data;
+    while (size) {
+        ssize_t n = pread(fd, p, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            if (n == 0) errno = EIO;
+            return 1;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int pwrite_full(int fd, const void* data, size_t size, u64 offset)
+{
+    const char* p = (const char*)data;
+    while (size) {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 1;
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return 0;
+}
+
+// n rows of `bytes` bytes, `pitch` apart in memory, written back to back.
+static int pwrite_rows(int fd, const u8* rows, u32 n, u32 pitch, u32 bytes, u64 offset)
+{
+    iovec iov[IOV_MAX];
+    for (u32 y = 0; y < n;) {
+        const u32 k = std::min<u32>(n - y, IOV_MAX);
+        for (u32 i = 0; i < k; ++i) iov[i] = {(void*)(rows + (u64)(y + i) * pitch), bytes};
+
+        // short writes are rare enough to finish row by row
+        ssize_t done = pwritev(fd, iov, k, offset);
+        if (done < 0 && errno != EINTR) return 1;
+        if (done < (ssize_t)((u64)k * bytes)) {
+            for (u32 i = 0; i < k; ++i) {
+                if (pwrite_full(fd, rows + (u64)(y + i) * pitch, bytes, offset + (u64)i * bytes)) return 1;
+            }
+        }
+        offset += (u64)k * bytes;
+        y += k;
+    }
+    return 0;
+}
+
+// Binary PPM or PGM with 8-bit samples: width, height, bytes per pixel
+// and where the pixels start.
+static int read_header(int fd, u32& w, u32& h, u32& s, u64& offset)
+{
+    char head[512];
+    ssize_t n = pread(fd, head, sizeof(head) - 1, 0);
+    if (n < 0) return BAND_IO;
+    head[n] = 0;
+    if (n < 2 || head[0] != 'P' || (head[1] != '6' && head[1] != '5')) return BAND_FORMAT;
+    s = head[1] == '6' ? 3 : 1;
+
+    u32 values[3];
+    const char* p = head + 2;
+    for (u32& v : values) {
+        while (*p == '#' || isspace((u8)*p)) {
+            if (*p == '#') while (*p && *p != '\n') ++p;
+            else ++p;
+        }
+        char* end;
+        v = strtoul(p, &end, 10);
+        if (end == p) return BAND_FORMAT;
+        p = end;
+    }
+    if (!isspace((u8)*p) || !values[0] || !values[1] || values[2] != 255) return BAND_FORMAT;
+
+    w = values[0];
+    h = values[1];
+    offset = p + 1 - head;
+    return BAND_OK;
+}
+
+// A file that is gone when closed.
+static int temp_file(const char* dir)
+{
+    std::string path = std::string(dir) + "/seamcarve-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd >= 0) unlink(path.c_str());
+    return fd;
+}
+
+// Costs of rows first to last, packed into b's table from row first on.
+// slots holds rows from y0 - 2 on, `pitch` apart, prev the costs of row
+// first - 1 (row 0 is made there).
+static void band_costs(band_carver& b, const u8* slots, u32 pitch, u32 y0, u32 first, u32 last, f32*& prev,
+                       f32*& cur)
+{
+    const u32 w = b.w, h = b.h;
+    f32* e = row(b.costs, 2);
+    u8* c = pixels(b.c);
+    packed_view table{pixels(b.choices), w, b.rows + 1, packed_view::row_bytes(w)};
+
+    for (u32 y = first; y < last; ++y) {
+        const u32 top = y > 0 ? y - 1 : 0, bottom = std::min(y + 1, h - 1);
+        buffer_view<u8> r{(u8*)slots + (u64)(top + 2 - y0) * pitch, w, bottom - top + 1, pitch, b.s};
+        if (y == 0) {
+            energy_row(r, 0, prev);
+            continue;
+        }
+        energy_row(r, y - top, e);
+        cost_row(prev, e, cur, c, w);
+        pack_row(table, y - first, c);
+        std::swap(prev, cur);
+    }
+}
+
+// The rows band k computes the costs of, the last one waiting for the
+// row below it unless it is the last of the image.
+static void band_rows(const band_carver& b, u32 k, u32& y0, u32& first, u32& last)
+{
+    y0 = k * b.rows;
+    const u32 n = std::min(b.rows, b.h - y0);
+    first = y0 > 0 ? y0 - 1 : 0;
+    last = y0 + n == b.h ? b.h : y0 + n - 1;
+}
+
+// Traces the seam ending at x back up the spilled choices, a band at a
+// time.
+static int trace_choices(band_carver& b, u32 x)
+{
+    const u32 rb = packed_view::row_bytes(b.w);
+    const b32 spill = b.rows < b.h;
+    packed_view table{pixels(b.choices), b.w, b.rows + 1, rb};
+
+    for (u32 y1 = b.h; y1 > 0;) {
+        const u32 y0 = y1 > b.rows + 1 ? y1 - (b.rows + 1) : 0;
+        if (spill) {
+            if (pread_full(b.spill, pixels(b.choices), (u64)(y1 - y0) * rb, (u64)y0 * rb)) return BAND_IO;
+            b.report.read += (u64)(y1 - y0) * rb;
+        }
+        for (u32 y = y1; y-- > y0;) {
+            b.xs[y] = x;
+            if (y > 0) x = x + choice_at(table, x, y - y0) - 1;
+        }
+        y1 = y0;
+    }
+    return BAND_OK;
+}
+
+// Traces the seam ending at x from the checkpoints: each band, from the
+// bottom, reads its rows of img again and makes its choices from the
+// cost row spilled above it.
+static int trace_checkpoints(band_carver& b, const band_file& img, u32 x)
+{
+    const u32 w = b.w, h = b.h;
+    packed_view table{pixels(b.choices), w, b.rows + 1, packed_view::row_bytes(w)};
+    f32* prev = row(b.costs, 0);
+    f32* cur = row(b.costs, 1);
+    u8* slots = pixels(b.band);
+
+    for (u32 k = (h + b.rows - 1) / b.rows; k-- > 0;) {
+        u32 y0, first, last;
+        band_rows(b, k, y0, first, last);
+
+        // rows y0 - 2 to the last one the energies reach
+        const u32 top = y0 > 2 ? y0 - 2 : 0, bottom = std::min(last + 1, h);
+        if (pread_full(img.fd, slots + (u64)(top + 2 - y0) * img.pitch, (u64)(bottom - top) * img.pitch,
+                       img.offset + (u64)top * img.pitch)) return BAND_IO;
+        b.report.read += (u64)(bottom - top) * img.pitch;
+        if (k > 0) {
+            if (pread_full(b.spill, prev, (u64)w * sizeof(f32), (u64)(k - 1) * w * sizeof(f32))) return BAND_IO;
+            b.report.read += (u64)w * sizeof(f32);
+        }
+        band_costs(b, slots, img.pitch, y0, first, last, prev, cur);
+
+        for (u32 y = last; y-- > first;) {
+            b.xs[y] = x;
+            if (y > 0) x = x + choice_at(table, x, y - first) - 1;
+        }
+    }
+    return BAND_OK;
+}
+
+// One sweep from src to dst (none for the first, which only reads),
+// taking out b.xs when removing. With cost, also finds the next seam,
+// leaves it in b.xs and its cost in *cost.
+static int sweep(band_carver& b, const band_file& src, const band_file* dst, b32 removing, f32* cost)
+{
+    const u32 w = b.w, h = b.h, s = b.s;
+    const u32 rb = packed_view::row_bytes(w);
+    const b32 spill = b.rows < h;
+    f32* prev = row(b.costs, 0);
+    f32* cur = row(b.costs, 1);
+
+    // slot i of the band holds row y0 - 2 + i
+    u8* slots = pixels(b.band);
+
+    for (u32 k = 0; k * b.rows < h; ++k) {
+        u32 y0, first, last;
+        band_rows(b, k, y0, first, last);
+        const u32 n = std::min(b.rows, h - y0);
+        if (y0 > 0) memmove(slots, slots + (u64)b.rows * src.pitch, 2 * (u64)src.pitch);
+
+        u8* band = slots + 2 * (u64)src.pitch;
+        if (pread_full(src.fd, band, (u64)n * src.pitch, src.offset + (u64)y0 * src.pitch)) return BAND_IO;
+        b.report.read += (u64)n * src.pitch;
+
+        if (removing) {
+            buffer_view<u8> v{band, w + 1, n, src.pitch, s};
+            remove_seam_columns(v, b.xs.data() + y0);
+        }
+        if (dst) {
+            if (pwrite_rows(dst->fd, band, n, src.pitch, w * s, dst->offset + (u64)y0 * dst->pitch)) return BAND_IO;
+            b.report.written += (u64)n * w * s;
+        }
+        if (!cost) continue;
+
+        // the cost row above the band, or the choices it makes
+        if (spill && b.checkpoints && k > 0) {
+            if (pwrite_full(b.spill, prev, (u64)w * sizeof(f32), (u64)(k - 1) * w * sizeof(f32))) return BAND_IO;
+            b.report.spilled += (u64)w * sizeof(f32);
+        }
+        band_costs(b, slots, src.pitch, y0, first, last, prev, cur);
+        if (spill && !b.checkpoints) {
+            if (pwrite_full(b.spill, pixels(b.choices), (u64)(last - first) * rb, (u64)first * rb)) return BAND_IO;
+            b.report.spilled += (u64)(last - first) * rb;
+        }
+    }
+    if (!cost) return BAND_OK;
+
+    u32 x = std::min_element(prev, prev + w) - prev;
+    *cost = prev[x];
+
+    // the bands are read again from what the costs were made of, the
+    // image as written, or as read when the sweep wrote nothing
+    if (spill && b.checkpoints) return trace_checkpoints(b, dst ? *dst : src, x);
+    return trace_choices(b, x);
+}
+
+int carve_file(const char* in_path, const char* out_path, u32 target_width, const band_options& options,
+               carve_stats* stats, band_report* report)
+{
+    auto start = std::chrono::steady_clock::now();
+    const char* dir = options.spill_dir ? options.spill_dir : getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+
+    band_files f;
+    f.in = open(in_path, O_RDONLY | O_CLOEXEC);
+    if (f.in < 0) return BAND_IO;
+
+    u32 w, h, s;
+    u64 offset;
+    int err = read_header(f.in, w, h, s, offset);
+    if (err) return err;
+    target_width = std::max(1u, std::min(target_width, w));
+
+    // everything but the band rows, then as many rows as fit
+    const u64 fixed = 2 * (u64)w * s + (u64)w * (3 * sizeof(f32) + 1) + packed_view::row_bytes(w) + (u64)h * 4;
+    const u64 per_row = (u64)w * s + packed_view::row_bytes(w);
+    if (options.memory < fixed + per_row) return BAND_MEMORY;
+
+    band_carver b;
+    b.w = w;
+    b.h = h;
+    b.s = s;
+    b.rows = (u32)std::min<u64>(h, (options.memory - fixed) / per_row);
+    b.band = buffer<u8>{w * s, b.rows + 2, w * s, 1};
+    b.choices = buffer<u8>{packed_view::row_bytes(w), b.rows + 1, packed_view::row_bytes(w), 1};
+    b.costs = buffer<f32>{w, 3, w, 1};
+    b.c = buffer<u8>{w, 1, w, 1};
+    b.xs.resize(h);
+    b.report.bands = (h + b.rows - 1) / b.rows;
+    b.report.band_rows = b.rows;
+
+    f.out = open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (f.out < 0) return BAND_IO;
+    char head[64];
+    const int head_size = snprintf(head, sizeof(head), "P%c\n%u %u\n255\n", s == 3 ? '6' : '5', target_width, h);
+    if (pwrite_full(f.out, head, head_size, 0)) return BAND_IO;
+
+    const u32 seams = w - target_width;
+    if (seams > 1 && (f.work = temp_file(dir)) < 0) return BAND_IO;
+    if (seams > 0 && b.rows < h && (f.spill = temp_file(dir)) < 0) return BAND_IO;
+    b.spill = f.spill;
+    b.checkpoints = options.checkpoints;
+    posix_fadvise(f.in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // sweep i takes out seam i - 1 and finds seam i; the first two read
+    // the input, the last writes the output
+    carve_stats cs;
+    for (u32 i = 0; i <= seams; ++i) {
+        b.w = w - i;
+        band_file src = i <= 1 ? band_file{f.in, offset, w * s} : band_file{f.work, 0, (w - i + 1) * s};
+        band_file dst = i == seams ? band_file{f.out, (u64)head_size, b.w * s} : band_file{f.work, 0, b.w * s};
+
+        f32 cost = 0;
+        err = sweep(b, src, i == 0 && seams > 0 ? nullptr : &dst, i > 0, i < seams ? &cost : nullptr);
+        if (err) return err;
+        if (i < seams) {
+            cs.seams++;
+            cs.energy += cost;
+        }
+    }
+    if (fsync(f.out)) return BAND_IO;
+
+    if (stats) {
+        stats->seams += cs.seams;
+        stats->energy += cs.energy;
+        stats->seconds += std::chrono::duration<f32>(std::chrono::steady_clock::now() - start).count();
+    }
+    if (report) *report = b.report;
+    return BAND_OK;
+}
@@ -0,0 +1,42 @@
+#ifndef BAND_CARVE_HPP
+#define BAND_CARVE_HPP
+
+// Out-of-core carving for images larger than memory. The image stays in
+// files and is streamed in horizontal bands, each seam reading and
+// writing it once from top to bottom. The choices of a seam are spilled
+// to disk as the bands go by and read back, band by band from the
+// bottom, to trace it. With checkpoints only the cost row above each
+// band is spilled, and tracing reads each band of the image once more to
+// make its choices again from it.
+
+#include "seamcarve.hpp"
+
+struct band_options {
+    u64 memory = 256 << 20;             // cap on the bands and rows in memory
+    const char* spill_dir = nullptr;    // working image and choices, $TMPDIR or /tmp
+    b32 checkpoints = 0;                // spill cost rows at band boundaries, not choices
+};
+
+// What the bands of a carve_file came to.
+struct band_report {
+    u32 bands = 0;          // per seam
+    u32 band_rows = 0;
+    u64 read = 0;           // bytes of image and choices
+    u64 written = 0;
+    u64 spilled = 0;        // bytes of choices or cost rows written
+};
+
+enum {
+    BAND_OK,
+    BAND_IO,            // a file can't be read or written, see errno
+    BAND_FORMAT,        // the input isn't a binary PPM (P6) or PGM (P5) with 8-bit samples
+    BAND_MEMORY,        // the cap doesn't fit a band of one row
+};
+
+// Carves the PPM or PGM at in_path down to target_width with exact seams
+// and writes it to out_path in the same format, in at most
+// options.memory bytes of buffers. Returns one of the codes above.
+int carve_file(const char* in_path, const char* out_path, u32 target_width, const band_options& options,
+               carve_stats* stats = nullptr, band_report* report = nullptr);
+
+#endif
@@ -0,0 +1,266 @@
+// Batch carving: decode, carve and encode run as separate stages with
+// bounded queues in between, so decoding the next image and encoding the
+// previous one overlap with carving. With several target widths each one
+// goes to the encoder while the carve continues to the next.
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "seamcarve.hpp"
+#include "profile.hpp"
+#include "imageio.hpp"
+#include "pipeline.hpp"
+
+struct job {
+    std::string in;
+    std::string out;
+    buffer<u8> image;
+    bool last;   // last output of this input
+};
+
+// outdir/name.png, or outdir/name-800.png for one of several widths
+static std::string output_name(const std::string& dir, const std::string& in, u32 target, bool several)
+{
+    std::string base = in.substr(in.find_last_of('/') + 1);
+    base = base.substr(0, base.find_last_of('.'));
+    if (several) base += "-" + std::to_string(target);
+    return dir + "/" + base + ".png";
+}
+
+static std::vector<u32> parse_widths(const char* s)
+{
+    std::vector<u32> widths;
+    while (*s) {
+        char* end;
+        u32 w = strtoul(s, &end, 10);
+        if (end == s) break;
+        if (w) widths.push_back(w);
+        s = *end == ',' ? end + 1 : end;
+    }
+    return widths;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: batch -w width[,width...] [-m exact|greedy] [-x carved-fraction] [-X] [-h height [-r]] [-p] [-d decoders] [-c carvers] [-e encoders] [-n in-flight] outdir image...\n");
+}
+
+static void print_stage(const char* name, const stage_stats& s, u32 threads, f32 wall)
+{
+    printf("%-7s %2u thread(s) %6u images  busy %7.2fs  starved %7.2fs  blocked %7.2fs  occupancy %5.1f%%\n",
+           name, threads, s.items, s.busy, s.starved, s.blocked,
+           wall > 0 ? 100.0f * s.busy / (wall * threads) : 0.0f);
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<u32> targets;
+    u32 cores = std::max(1u, std::thread::hardware_concurrency());
+    u32 decoders = 1, encoders = 1;
+    u32 carvers = cores > 2 ? cores - 2 : 1;
+    u32 in_flight = 0;
+    seam_mode mode = SEAM_EXACT;
+    hybrid_split split;
+    b32 hybrid = 0;
+    u32 target_height = 0;
+    retarget_order order = RETARGET_CHEAPEST;
+    b32 profiling = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "w:m:x:Xh:rpd:c:e:n:")) != -1) {
+        switch (opt) {
+            case 'w': targets = parse_widths(optarg); break;
+            case 'm':
+                if (parse_seam_mode(optarg, &mode)) {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'x': hybrid = 1; split.carved = atof(optarg); break;
+            case 'X': hybrid = 1; split.carve_first = 1; break;
+            case 'h': target_height = atoi(optarg); break;
+            case 'r': order = RETARGET_RATIO; break;
+            case 'p': profiling = 1; break;
+            case 'd': decoders = std::max(1, atoi(optarg)); break;
+            case 'c': carvers = std::max(1, atoi(optarg)); break;
+            case 'e': encoders = std::max(1, atoi(optarg)); break;
+            case 'n': in_flight = std::max(1, atoi(optarg)); break;
+            default: usage(); return 1;
+        }
+    }
+    if (targets.empty() || argc - optind < 2) {
+        usage();
+        return 1;
+    }
+    if (!in_flight) in_flight = decoders + carvers + encoders;
+
+    const std::string outdir = argv[optind];
+    std::vector<std::string> inputs(argv + optind + 1, argv + argc);
+
+    bounded_queue<job> carve_q(std::max(1u, carvers));
+    bounded_queue<job> encode_q(std::max(1u, encoders));
+    in_flight_limit limit(in_flight);
+
+    std::vector<stage_stats> decode_stage(decoders), carve_stage(carvers), encode_stage(encoders);
+    std::vector<std::unique_ptr<carve_profile>> profiles(carvers);
+    std::atomic<u32> next{0};
+    std::atomic<u32> failed{0};
+
+    auto start = pipeline_clock::now();
+
+    std::vector<std::thread> decode_threads, carve_threads, encode_threads;
+
+    for (u32 i = 0; i < decoders; ++i) {
+        decode_threads.emplace_back([&, i] {
+            stage_stats& st = decode_stage[i];
+            u32 n;
+            while ((n = next++) < inputs.size()) {
+                auto t = pipeline_clock::now();
+                limit.acquire();
+                st.blocked += seconds_since(t);
+
+                job j;
+                j.in = inputs[n];
+
+                t = pipeline_clock::now();
+                int err = load_image(j.image, j.in.c_str());
+                st.busy += seconds_since(t);
+
+                if (err) {
+                    fprintf(stderr, "%s: can't decode\n", j.in.c_str());
+                    failed++;
+                    limit.release();
+                    continue;
+                }
+                st.items++;
+
+                t = pipeline_clock::now();
+                carve_q.push(std::move(j));
+                st.blocked += seconds_since(t);
+            }
+        });
+    }
+
+    for (u32 i = 0; i < carvers; ++i) {
+        carve_threads.emplace_back([&, i] {
+            stage_stats& st = carve_stage[i];
+            carve_workspace ws;
+            ws.mode = mode;
+            retarget_workspace rws;
+            if (profiling) {
+                // counters follow the thread that opens them
+                profiles[i].reset(new carve_profile);
+                ws.profile = profiles[i].get();
+            }
+            job j;
+            for (;;) {
+                auto t = pipeline_clock::now();
+                if (!carve_q.pop(j)) break;
+                st.starved += seconds_since(t);
+
+                t = pipeline_clock::now();
+                buffer_view<u8> v = view(j.image);
+                u32 emitted = 0;
+                carve_stats cs;
+                auto emit = [&](const buffer_view<u8>& image, u32 target) {
+                    job o;
+                    o.in = j.in;
+                    o.out = output_name(outdir, j.in, target, targets.size() > 1);
+                    o.image = copy(image);
+                    o.last = ++emitted == targets.size();
+
+                    st.busy += seconds_since(t);
+                    t = pipeline_clock::now();
+                    encode_q.push(std::move(o));
+                    st.blocked += seconds_since(t);
+                    t = pipeline_clock::now();
+                };
+                if (target_height) {
+                    // seams in both directions, every size from the original
+                    for (u32 target : targets) {
+                        buffer<u8> b = copy(v);
+                        buffer_view<u8> bv = view(b);
+                        retarget(bv, target, target_height, order, rws, &cs);
+                        emit(bv, target);
+                    }
+                } else if (hybrid) {
+                    // resampling doesn't continue from one width to the next,
+                    // every width starts from the original
+                    for (u32 target : targets) {
+                        buffer<u8> b = copy(v);
+                        buffer_view<u8> bv = view(b);
+                        carve_hybrid(bv, target, split, ws, &cs);
+                        emit(bv, target);
+                    }
+                } else {
+                    carve_targets(v, targets, ws, emit, &cs);
+                }
+                st.busy += seconds_since(t);
+                st.items++;
+
+                printf("%s: %s, %u seams (%u horizontal), %u resampled, energy %.0f, %.3fs\n", j.in.c_str(),
+                       seam_mode_name(mode), cs.seams, cs.horizontal, cs.resampled, cs.energy, cs.seconds);
+            }
+        });
+    }
+
+    for (u32 i = 0; i < encoders; ++i) {
+        encode_threads.emplace_back([&, i] {
+            stage_stats& st = encode_stage[i];
+            job j;
+            for (;;) {
+                auto t = pipeline_clock::now();
+                if (!encode_q.pop(j)) break;
+                st.starved += seconds_since(t);
+
+                t = pipeline_clock::now();
+                if (save_image(j.image, j.out.c_str())) {
+                    fprintf(stderr, "%s: can't encode\n", j.out.c_str());
+                    failed++;
+                }
+                j.image = buffer<u8>{};
+                st.busy += seconds_since(t);
+                st.items++;
+
+                if (j.last) limit.release();
+            }
+        });
+    }
+
+    for (auto& t : decode_threads) t.join();
+    carve_q.close();
+    for (auto& t : carve_threads) t.join();
+    encode_q.close();
+    for (auto& t : encode_threads) t.join();
+
+    f32 wall = seconds_since(start);
+
+    auto total = [](const std::vector<stage_stats>& v) {
+        stage_stats s;
+        for (auto& x : v) {
+            s.items += x.items;
+            s.busy += x.busy;
+            s.starved += x.starved;
+            s.blocked += x.blocked;
+        }
+        return s;
+    };
+
+    printf("%zu images in %.2fs, %u failed\n", inputs.size(), wall, failed.load());
+    print_stage("decode", total(decode_stage), decoders, wall);
+    print_stage("carve", total(carve_stage), carvers, wall);
+    print_stage("encode", total(encode_stage), encoders, wall);
+
+    if (profiling) {
+        for (u32 i = 1; i < carvers; ++i) profiles[0]->add(*profiles[i]);
+        print_profile(stdout, *profiles[0]);
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,251 @@
+// Benchmarks of the carving kernels, at every SIMD level the cpu has.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "carve.hpp"
+#include "resample.hpp"
+
+typedef std::chrono::steady_clock bench_clock;
+
+template <typename F>
+static f32 time_ns(u32 repeat, F f)
+{
+    auto t = bench_clock::now();
+    for (u32 i = 0; i < repeat; ++i) f();
+    return std::chrono::duration<f32, std::nano>(bench_clock::now() - t).count() / repeat;
+}
+
+template <typename T>
+static void fill_random(std::vector<T>& v, u32 seed)
+{
+    for (auto& x : v) {
+        seed = seed * 1103515245u + 12345u;
+        x = (T)((seed >> 16) & 1023);
+    }
+}
+
+// min3_row and argmin3_row on rows of n values
+template <typename T>
+static void bench_min3(const char* type, u32 n)
+{
+    std::vector<T> prev(n + 2), add(n), out(n), ref_out(n);
+    std::vector<u8> choice(n), ref_choice(n);
+    fill_random(prev, n);
+    fill_random(add, n + 1);
+
+    const u32 repeat = 200000000 / n;
+    f32 scalar_ns = 0;
+
+    for (int l = SIMD_SCALAR; l <= detect_simd(); ++l) {
+        set_simd((simd_level)l);
+
+        f32 cost_ns = time_ns(repeat, [&] { min3_row(prev.data(), add.data(), out.data(), choice.data(), n); });
+        f32 arg_ns = time_ns(repeat, [&] { argmin3_row(prev.data(), choice.data(), n); });
+
+        if (l == SIMD_SCALAR) {
+            scalar_ns = cost_ns;
+            min3_row(prev.data(), add.data(), ref_out.data(), ref_choice.data(), n);
+        }
+        min3_row(prev.data(), add.data(), out.data(), choice.data(), n);
+        bool same = out == ref_out && choice == ref_choice;
+
+        printf("min3_row    %-4s %5u  %-6s  %7.3f ns/px  argmin %7.3f ns/px  x%.2f%s\n",
+               type, n, simd_name((simd_level)l), cost_ns / n, arg_ns / n,
+               scalar_ns / cost_ns, same ? "" : "  MISMATCH");
+    }
+    set_simd(detect_simd());
+}
+
+// moving pixels for a seam against moving indices
+static void bench_remove(u32 w, u32 h)
+{
+    buffer<u8> image{w, h, w * 3, 3};
+    buffer<u8> choice{w, h, w, 1};
+    buffer_view<u8> v = view(image);
+    index_map<u16> m{v};
+
+    const u32 seams = 20;
+    f32 physical = time_ns(1, [&] {
+        for (u32 i = 0; i < seams; ++i) {
+            remove_path(v, choice, w / 2);
+            set_width(v, width(v) - 1);
+        }
+    });
+    f32 lazy = time_ns(1, [&] {
+        for (u32 i = 0; i < seams; ++i) {
+            remove_path(m.index, choice, w / 2);
+            set_width(m.index, width(m) - 1);
+        }
+    });
+
+    printf("remove_path %5ux%-5u pixels %7.3f ms/seam  indices %7.3f ms/seam\n",
+           w, h, physical / seams / 1e6f, lazy / seams / 1e6f);
+}
+
+// exact seam costs from a full energy buffer against energies streamed a
+// row at a time into the cost rows
+static void bench_fused(u32 w, u32 h)
+{
+    buffer<u8> image{w, h, padded_pitch(w * 3, 1), 3};
+    u32 seed = 3;
+    for (auto& p : image) p = (seed = seed * 1103515245u + 12345u) >> 24;
+    buffer_view<u8> in = view(image);
+
+    buffer<u8> choices{packed_view::row_bytes(w), h, packed_view::row_bytes(w), 1};
+    packed_view table{pixels(choices), w, h, pitch(choices)};
+    std::vector<f32> prev(w), cur(w), e(w), split_last(w);
+    std::vector<u8> c(w);
+
+    buffer<f32> edges{w, h, padded_pitch(w, sizeof(f32)), 1};
+    buffer_view<f32> ev = view(edges);
+    f32 split_ns = time_ns(3, [&] {
+        edge_detect(in, ev);
+        std::copy_n(row(ev, 0), w, prev.data());
+        for (u32 y = 1; y < h; ++y) {
+            cost_row(prev.data(), row(ev, y), cur.data(), c.data(), w);
+            pack_row(table, y, c.data());
+            std::swap(prev, cur);
+        }
+    });
+    split_last = prev;
+
+    f32 fused_ns = time_ns(3, [&] {
+        energy_row(in, 0, prev.data());
+        for (u32 y = 1; y < h; ++y) {
+            energy_row(in, y, e.data());
+            cost_row(prev.data(), e.data(), cur.data(), c.data(), w);
+            pack_row(table, y, c.data());
+            std::swap(prev, cur);
+        }
+    });
+
+    printf("exact costs %5ux%-5u energy buffer %8.2f ms  streamed %8.2f ms  x%.2f%s\n", w, h,
+           split_ns / 1e6f, fused_ns / 1e6f, split_ns / fused_ns, prev == split_last ? "" : "  MISMATCH");
+}
+
+// area filter from w to out_w on an RGB image
+static void bench_resample(u32 w, u32 h, u32 out_w)
+{
+    buffer<u8> image{w, h, padded_pitch(w * 3, 1), 3};
+    u32 seed = 7;
+    for (auto& p : image) p = (seed = seed * 1103515245u + 12345u) >> 24;
+
+    buffer<u8> ref{out_w, h, out_w * 3, 3}, out{out_w, h, out_w * 3, 3};
+    buffer_view<u8> ref_v = view(ref), out_v = view(out);
+    f32 scalar_ns = 0;
+
+    for (int l = SIMD_SCALAR; l <= detect_simd(); ++l) {
+        set_simd((simd_level)l);
+
+        f32 ns = time_ns(5, [&] { resample_rows(view(image), out_v); });
+        if (l == SIMD_SCALAR) {
+            scalar_ns = ns;
+            resample_rows(view(image), ref_v);
+        }
+        b32 same = std::equal(begin(ref), end(ref), begin(out));
+
+        printf("resample %5u->%-5u x%-5u %-6s  %7.2f ms  x%.2f%s\n", w, out_w, h,
+               simd_name((simd_level)l), ns / 1e6f, scalar_ns / ns, same ? "" : "  MISMATCH");
+    }
+    set_simd(detect_simd());
+}
+
+// retarget by columns and rows from one energy map against the two 1D
+// carves it replaces, the rows carved from a transposed copy
+static void bench_retarget(u32 w, u32 h, u32 columns, u32 rows)
+{
+    buffer<u8> image{w, h, padded_pitch(w * 3, 1), 3};
+    u32 seed = 5;
+    for (auto& p : image) p = (seed = seed * 1103515245u + 12345u) >> 24;
+
+    buffer<u8> transposed{h, w - columns, padded_pitch(h * 3, 1), 3};
+    carve_workspace ws;
+    f32 carve_ns = time_ns(1, [&] {
+        buffer<u8> b = image;
+        buffer_view<u8> v = view(b);
+        carve(v, w - columns, ws);
+    });
+    for (u32 y = 0; y < w - columns; ++y) {
+        for (u32 x = 0; x < h; ++x) std::copy_n(row(image, x) + y * 3, 3, row(transposed, y) + x * 3);
+    }
+    carve_ns += time_ns(1, [&] {
+        buffer_view<u8> v = view(transposed);
+        carve(v, h - rows, ws);
+    });
+
+    retarget_workspace rws;
+    for (retarget_order order : {RETARGET_CHEAPEST, RETARGET_RATIO}) {
+        carve_stats cs;
+        f32 ns = time_ns(1, [&] {
+            buffer<u8> b = image;
+            buffer_view<u8> v = view(b);
+            retarget(v, w - columns, h - rows, order, rws, &cs);
+        });
+        printf("retarget %5ux%-5u -%u,-%u %-8s %8.2f ms  two carves %8.2f ms  x%.2f  %u horizontal\n", w, h,
+               columns, rows, order == RETARGET_CHEAPEST ? "cheapest" : "ratio", ns / 1e6f, carve_ns / 1e6f,
+               carve_ns / ns, cs.horizontal);
+    }
+}
+
+// edge_detect and a walk down the columns, which takes a TLB miss per row
+// on small pages and hits one cache set per column on 4 KB aligned rows.
+// The pages column is what the kernel gave, not the policy asked for.
+static void bench_pages(u32 w, u32 h)
+{
+    for (int policy = PAGES_SMALL; policy <= PAGES_HUGETLB; ++policy) {
+        set_page_policy((page_policy)policy);
+
+        for (b32 padded : {0, 1}) {
+            // a pitch padding leaves alone is only timed packed
+            const u32 edge_pitch = padded ? padded_pitch(w, sizeof(f32)) : w;
+            if (padded && edge_pitch == w && padded_pitch(w * 3, 1) == w * 3) continue;
+
+            buffer<u8> image{w, h, padded ? padded_pitch(w * 3, 1) : w * 3, 3};
+            buffer<f32> edges{w, h, edge_pitch, 1};
+            buffer_view<u8> in = view(image);
+            buffer_view<f32> out = view(edges);
+            u32 seed = 1;
+            for (auto& p : image) p = (seed = seed * 1103515245u + 12345u) >> 24;
+
+            f32 edge_ns = time_ns(3, [&] { edge_detect(in, out); });
+
+            const u32 step = 8;
+            volatile f32 sink = 0;
+            f32 column_ns = time_ns(3, [&] {
+                f32 sum = 0;
+                for (u32 x = 0; x < w; x += step) {
+                    for (u32 y = 0; y < h; ++y) sum += row(out, y)[x];
+                }
+                sink = sink + sum;
+            });
+
+            const f32 bytes = (f32)w * h * (3 + sizeof(f32));
+            printf("pages %5ux%-5u %-7s got %-7s pitch %6u B  edge_detect %7.2f ms %6.2f GB/s  columns %6.2f ns/px\n",
+                   w, h, page_policy_name((page_policy)policy), pages_of(pixels(edges)),
+                   edge_pitch * (u32)sizeof(f32), edge_ns / 1e6f, bytes / edge_ns, column_ns / (w / step * h));
+        }
+    }
+    set_page_policy(PAGES_TRANSPARENT);
+}
+
+int main()
+{
+    for (u32 n : {3840u, 7680u}) {
+        bench_min3<f32>("f32", n);
+        bench_min3<s32>("s32", n);
+    }
+    bench_remove(3840, 2160);
+    bench_remove(7680, 4320);
+    bench_fused(3840, 2160);
+    bench_fused(7680, 4320);
+    bench_fused(12000, 8000);
+    bench_resample(4000, 2160, 800);
+    bench_resample(3840, 2160, 2880);
+    bench_retarget(1280, 720, 128, 72);
+    bench_pages(4096, 4096);
+    bench_pages(7680, 4320);
+    return 0;
+}
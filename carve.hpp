@@ -0,0 +1,446 @@
+#ifndef CARVE_HPP
+#define CARVE_HPP
+
+// Kernels behind libseamcarve, on any buffer or view.
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+#include "seamcarve.hpp"
+#include "choice.hpp"
+#include "min3.hpp"
+#include "index_map.hpp"
+
+// should return sum of squares of differences between channels
+// (R(p1) - R(p0))^2 + (G(p1) - G(p0))^2 + (B(p1) - B(p0))^2
+inline f32 edge(u8 x, u8 y)
+{
+    f32 a = (f32)x;
+    f32 b = (f32)y;
+    return (b-a) * (b-a);
+}
+
+template <typename T>
+int smallest(T a, T b, T c)
+{
+    if (b < a) {
+        if (c < b) {
+            return 2;
+        } else {
+            return 1;
+        }
+    } else {
+        if (c < a) {
+            return 2;
+        } else {
+            return 0;
+        }
+    }
+}
+
+template <typename I>
+struct energy {
+    int n;
+    energy(int n) : n(n) {}
+    f32 operator()(I f0, I f1, I f2)
+    {
+        f32 x = 0.0f;
+        for (int i = 0; i < n; ++i) {
+            x += edge(*(f0+i), *(f2+i));
+        }
+        return x;
+    }
+};
+
+template <typename I, typename B, typename N, typename O, typename Op>
+O op_row3_n(I f0, I f1, I f2, B f_s, N n, O out, B o_s, Op op)
+{
+    while (n--) {
+        *out += op(f0, f1, f2);
+        f0 += f_s;
+        f1 += f_s;
+        f2 += f_s;
+        out += o_s;
+    }
+
+    return out;
+}
+
+template <ReadBuffer I, WriteBuffer O>
+void edge_detect_h(const I& in, O& out)
+{
+    // edge detect
+    // energy differentiation between the rows above and below,
+    // border rows are clamped
+
+    assert(height(in) > 0);
+    assert(width(in) > 0);
+
+    const u32 h = height(in);
+
+    for (u32 y = 0; y < h; ++y) {
+        const u8* src0 = row(in, y > 0 ? y-1 : 0);
+        const u8* src1 = row(in, y);
+        const u8* src2 = row(in, y+1 < h ? y+1 : h-1);
+        f32* dst = row(out, y);
+
+        std::fill(dst, dst+width(in)*bpp(out), 0);
+        op_row3_n(src0, src1, src2, bpp(in), width(in), dst, bpp(out), energy<const u8*>{bpp(in)});
+    }
+}
+
+template <ReadBuffer I, WriteBuffer O>
+void edge_detect_w(const I& in, O& out)
+{
+    // edge detect
+    // energy differentiation between the columns left and right,
+    // border columns are clamped
+
+    const u32 w = width(in);
+
+    for (u32 x = 0; x < w; ++x) {
+        const u8* src0 = row(in, 0) + (x > 0 ? x-1 : 0) * bpp(in);
+        const u8* src1 = row(in, 0) + x * bpp(in);
+        const u8* src2 = row(in, 0) + (x+1 < w ? x+1 : w-1) * bpp(in);
+        f32* dst = row(out, 0) + x * bpp(out);
+
+        op_row3_n(src0, src1, src2, pitch(in), height(in), dst, pitch(out), energy<const u8*>{bpp(in)});
+    }
+}
+
+template <ReadBuffer I, WriteBuffer O>
+void edge_detect(const I& in, O& out)
+{
+    // edge detect
+    // energy differentiation
+    edge_detect_h(in, out);
+    edge_detect_w(in, out);
+}
+
+// Energy of the pixel at (x, y), the value edge_detect gives.
+template <ReadBuffer I>
+inline f32 energy_at(const I& in, u32 x, u32 y)
+{
+    const u32 w = width(in), h = height(in), s = bpp(in);
+    const u8* up = row(in, y > 0 ? y-1 : 0) + x * s;
+    const u8* down = row(in, y+1 < h ? y+1 : h-1) + x * s;
+    const u8* left = row(in, y) + (x > 0 ? x-1 : 0) * s;
+    const u8* right = row(in, y) + (x+1 < w ? x+1 : w-1) * s;
+
+    f32 v = 0.0f, e = 0.0f;
+    for (u32 c = 0; c < s; ++c) v += edge(up[c], down[c]);
+    for (u32 c = 0; c < s; ++c) e += edge(left[c], right[c]);
+    return v + e;
+}
+
+// Energies of row y alone, for kernels that use every row as soon as it
+// is computed. Reads rows y-1 to y+1.
+template <ReadBuffer I>
+void energy_row(const I& in, u32 y, f32* out)
+{
+    const u32 w = width(in), h = height(in), s = bpp(in);
+    const u8* up = row(in, y > 0 ? y-1 : 0);
+    const u8* mid = row(in, y);
+    const u8* down = row(in, y+1 < h ? y+1 : h-1);
+
+    for (u32 x = 0; x < w; ++x) {
+        const u8* left = mid + (x > 0 ? x-1 : 0) * s;
+        const u8* right = mid + (x+1 < w ? x+1 : w-1) * s;
+
+        f32 v = 0.0f, e = 0.0f;
+        for (u32 c = 0; c < s; ++c) v += edge(up[x*s + c], down[x*s + c]);
+        for (u32 c = 0; c < s; ++c) e += edge(left[c], right[c]);
+        out[x] = v + e;
+    }
+}
+
+// Same on the materialized image, reading the pixels through the index
+// map.
+template <typename I>
+void energy_row(const index_map<I>& in, u32 y, f32* out)
+{
+    const u32 w = width(in), h = height(in), s = bpp(in);
+    const u32 y0 = y > 0 ? y-1 : 0;
+    const u32 y2 = y+1 < h ? y+1 : h-1;
+
+    for (u32 x = 0; x < w; ++x) {
+        const u8* up = pixel(in, x, y0);
+        const u8* down = pixel(in, x, y2);
+        const u8* left = pixel(in, x > 0 ? x-1 : 0, y);
+        const u8* right = pixel(in, x+1 < w ? x+1 : w-1, y);
+
+        f32 v = 0.0f, e = 0.0f;
+        for (u32 c = 0; c < s; ++c) v += edge(up[c], down[c]);
+        for (u32 c = 0; c < s; ++c) e += edge(left[c], right[c]);
+        out[x] = v + e;
+    }
+}
+
+template <typename I, WriteBuffer O>
+void edge_detect(const index_map<I>& in, O& out)
+{
+    assert(bpp(out) == 1);
+    for (u32 y = 0; y < height(in); ++y) energy_row(in, y, row(out, y));
+}
+
+// next x of the path below x, given the choice at x
+inline u32 next_x(u32 x, u8 c, u32 w)
+{
+    if (x == 0 && c == 0) return 0;
+    if (x == w-1 && c == 2) return w-1;
+    return x + c - 1;
+}
+
+// Choice for x from the energies of the row above, what calculate_paths
+// stores for every pixel.
+inline u8 greedy_choice(const f32* above, u32 x, u32 w, u32 s)
+{
+    if (w < 3) return 1;
+
+    // borders only have two neighbours
+    if (x == 0) return above[s] < above[0] ? 2 : 1;
+    if (x == w-1) return above[(w-2) * s] < above[(w-1) * s] ? 0 : 1;
+
+    return smallest(above[(x-1) * s], above[x * s], above[(x+1) * s]);
+}
+
+// No table at all: the choices of a row only depend on the energies of
+// the row above, so they are recomputed from there when a path passes.
+template <ReadBuffer E>
+struct recomputed_choice {
+    const E& energies;
+};
+
+template <ReadBuffer E> inline
+u32 width(const recomputed_choice<E>& c) { return width(c.energies); }
+
+template <ReadBuffer E> inline
+u8 choice_at(const recomputed_choice<E>& c, u32 x, u32 y)
+{
+    if (y == 0) return 1;
+    return greedy_choice(row(c.energies, y-1), x, width(c.energies), bpp(c.energies));
+}
+
+template <ReadBuffer E, typename C>
+void find_path(const E& energies, const C& choice, u32 x, f32* sum)
+{
+    u32 y = 0;
+
+    while (y < height(energies)) {
+        const f32* e_row = row(energies, y);
+        *sum += e_row[x];
+
+        // next x;
+        x = next_x(x, choice_at(choice, x, y), width(choice));
+
+        // next y
+        y++;
+    }
+}
+
+template <WriteBuffer B, typename C>
+void remove_path(B& image, const C& choice, u32 x)
+{
+    u32 y = 0;
+
+    while (y < height(image)) {
+        auto i_row = row(image, y);
+
+        // copy row, only the part inside the view moves
+        auto f0 = i_row + x * bpp(image);
+        auto f1 = i_row + (x + 1) * bpp(image);
+        auto l  = i_row + width(image) * bpp(image);
+
+        std::copy(f1, l, f0);
+
+        // next x;
+        x = next_x(x, choice_at(choice, x, y), width(choice));
+
+        // next y
+        y++;
+    }
+}
+
+template <ReadBuffer E, WriteBuffer C>
+void calculate_paths(const E& in, C& out)
+{
+    // path of smallest energy
+    const u32 w = width(out);
+
+    std::fill(row(out, 0), row(out, 0) + w * bpp(out), 1);
+
+    for (u32 y = 1; y < height(in); ++y) {
+        const f32* src0 = row(in, y-1);
+        u8* dst = row(out, y);
+
+        if (w < 3) {
+            std::fill(dst, dst + w * bpp(out), 1);
+            continue;
+        }
+
+        // borders only have two neighbours
+        dst[0] = greedy_choice(src0, 0, w, bpp(in));
+        dst[(w-1) * bpp(out)] = greedy_choice(src0, w-1, w, bpp(in));
+
+        if (bpp(in) == 1 && bpp(out) == 1) {
+            argmin3_row(src0, dst + 1, w - 2);
+            continue;
+        }
+
+        dst += bpp(out);
+        for (u32 x = 1; x < w-1; ++x) {
+            u8 v = smallest(*src0, *(src0+bpp(in)), *(src0+2*bpp(in)));
+            assert(v == 0 || v == 1 || v == 2);
+            *dst = v; // 0, 1, 2
+            src0+=bpp(in);
+            dst+=bpp(out);
+        }
+    }
+}
+
+// Same choices as above, packed while they are computed.
+template <ReadBuffer E>
+void calculate_paths(const E& in, packed_view& out)
+{
+    const u32 w = width(out);
+    const u32 s = bpp(in);
+    const u32 n = packed_view::row_bytes(w);
+
+    // all straight: 01 01 01 01
+    std::fill(row(out, 0), row(out, 0) + n, 0x55);
+
+    // choices go through a small byte chunk on their way to the row
+    const u32 chunk = 256;
+    u8 c[chunk];
+
+    for (u32 y = 1; y < height(in); ++y) {
+        const f32* src0 = row(in, y-1);
+        u8* dst = row(out, y);
+
+        for (u32 x0 = 0; x0 < w; x0 += chunk) {
+            const u32 x1 = std::min(w, x0 + chunk);
+
+            // interior of the row in this chunk
+            const u32 i0 = std::max(x0, 1u);
+            const u32 i1 = std::min(x1, w > 1 ? w-1 : 1);
+            if (s == 1 && i0 < i1) {
+                argmin3_row(src0 + i0 - 1, c + (i0 - x0), i1 - i0);
+            } else {
+                for (u32 x = i0; x < i1; ++x) c[x - x0] = greedy_choice(src0, x, w, s);
+            }
+            if (x0 == 0) c[0] = greedy_choice(src0, 0, w, s);
+            if (x1 == w) c[w-1 - x0] = greedy_choice(src0, w-1, w, s);
+
+            for (u32 x = x0; x < x1; x += 4) {
+                u8 b = c[x - x0];
+                if (x+1 < x1) b |= c[x+1 - x0] << 2;
+                if (x+2 < x1) b |= c[x+2 - x0] << 4;
+                if (x+3 < x1) b |= c[x+3 - x0] << 6;
+                dst[x >> 2] = b;
+            }
+        }
+    }
+}
+
+// One row of cumulative cost for exact seams: cur[x] is e[x] plus the
+// cheapest of the (up to) three costs above it, whose side goes to c.
+inline void cost_row(const f32* prev, const f32* e, f32* cur, u8* c, u32 w)
+{
+    if (w == 1) {
+        c[0] = 1;
+        cur[0] = e[0] + prev[0];
+        return;
+    }
+
+    // borders only have two neighbours
+    c[0] = prev[1] < prev[0] ? 2 : 1;
+    c[w-1] = prev[w-2] < prev[w-1] ? 0 : 1;
+    cur[0] = e[0] + prev[c[0] - 1];
+    cur[w-1] = e[w-1] + prev[w-2 + c[w-1]];
+
+    if (w > 2) min3_row(prev, e + 1, cur + 1, c + 1, w - 2);
+}
+
+// Removes the pixel at xs[y] from every row y.
+template <WriteBuffer B>
+void remove_seam_columns(B& image, const u32* xs)
+{
+    for (u32 y = 0; y < height(image); ++y) {
+        auto i_row = row(image, y);
+        auto f0 = i_row + xs[y] * bpp(image);
+        auto f1 = i_row + (xs[y] + 1) * bpp(image);
+        auto l  = i_row + width(image) * bpp(image);
+
+        std::copy(f1, l, f0);
+    }
+}
+
+// Removes the pixel at ys[x] from every column x, moving the pixels below
+// it up a row. Goes row by row, so memory is read in order.
+template <WriteBuffer B>
+void remove_seam_rows(B& image, const u32* ys)
+{
+    const u32 w = width(image), s = bpp(image);
+    for (u32 y = 0; y + 1 < height(image); ++y) {
+        auto dst = row(image, y);
+        auto src = row(image, y + 1);
+        for (u32 x = 0; x < w; ++x) {
+            if (y < ys[x]) continue;
+            std::copy_n(src + x * s, s, dst + x * s);
+        }
+    }
+}
+
+// n columns of e from x0 on, each one contiguous in out: column i
+// starts at out + i * height(e).
+template <ReadBuffer E>
+void gather_columns(const E& e, u32 x0, u32 n, f32* out)
+{
+    const u32 h = height(e);
+    for (u32 y = 0; y < h; ++y) {
+        const f32* r = row(e, y) + x0;
+        for (u32 i = 0; i < n; ++i) out[i * h + y] = r[i];
+    }
+}
+
+// sum holds at least width(in) values
+template <ReadBuffer E, typename C>
+u32 find_minimum_path(const E& in, const C& out, f32* sum, f32* cost = nullptr)
+{
+    std::fill(sum, sum + width(in), 0);
+
+    for (u32 x = 0; x < width(out); ++x) {
+        find_path(in, out, x, &sum[x]);
+    }
+
+    auto f = sum;
+    auto l = sum + width(in);
+
+    auto m = std::min_element(f, l);
+    u32 x = m - f;
+    if (cost) *cost = *m;
+    return x;
+}
+
+// Keeps seams out of the first `left` and last `right` columns.
+inline void protect_row(f32* e, u32 w, u32 left, u32 right)
+{
+    const f32 inf = std::numeric_limits<f32>::infinity();
+    std::fill(e, e + left, inf);
+    std::fill(e + w - right, e + w, inf);
+}
+
+template <WriteBuffer E>
+void protect_columns(E& energies, u32 left, u32 right)
+{
+    const f32 inf = std::numeric_limits<f32>::infinity();
+    for (u32 y = 0; y < height(energies); ++y) {
+        f32* e_row = row(energies, y);
+        std::fill(e_row, e_row + left * bpp(energies), inf);
+        std::fill(e_row + (width(energies) - right) * bpp(energies),
+                  e_row + width(energies) * bpp(energies), inf);
+    }
+}
+
+#endif
@@ -0,0 +1,1051 @@
+// Differential checks: every optimized path of libseamcarve against a
+// deliberately simple reference carver, on random images and on the
+// cases kernels get wrong (ties, flat regions, 1-3 pixel widths, edge
+// columns). Prints the first divergence of each path and its time.
+//
+//     make check
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "band_carve.hpp"
+#include "seamcarve.hpp"
+#include "seam_order.hpp"
+#include "seam_stack.hpp"
+#include "resample.hpp"
+#include "min3.hpp"
+
+// --- reference ---------------------------------------------------------
+//
+// Plain vectors and loops, one rule per line. The tie rules are part of
+// what is checked: the cheapest of left, straight, right wins, the first
+// one on a tie, except at the borders where straight wins a tie.
+
+struct ref_image {
+    u32 w, h, s;
+    std::vector<std::vector<u8>> rows;
+};
+
+struct ref_seam {
+    std::vector<u32> xs;
+    f32 cost;
+};
+
+static ref_image to_ref(const buffer_view<u8>& b)
+{
+    ref_image r{width(b), height(b), bpp(b), {}};
+    for (u32 y = 0; y < r.h; ++y) r.rows.emplace_back(row(b, y), row(b, y) + r.w * r.s);
+    return r;
+}
+
+static f32 diff2(u8 a, u8 b)
+{
+    f32 d = (f32)b - (f32)a;
+    return d * d;
+}
+
+// vertical differences of all channels, then the horizontal ones,
+// neighbours clamped at the borders
+static std::vector<std::vector<f32>> ref_energy(const ref_image& im)
+{
+    std::vector<std::vector<f32>> e(im.h, std::vector<f32>(im.w));
+    for (u32 y = 0; y < im.h; ++y) {
+        const u32 up = y > 0 ? y - 1 : 0, down = y + 1 < im.h ? y + 1 : im.h - 1;
+        for (u32 x = 0; x < im.w; ++x) {
+            const u32 left = x > 0 ? x - 1 : 0, right = x + 1 < im.w ? x + 1 : im.w - 1;
+            f32 v = 0, hz = 0;
+            for (u32 c = 0; c < im.s; ++c) v += diff2(im.rows[up][x * im.s + c], im.rows[down][x * im.s + c]);
+            for (u32 c = 0; c < im.s; ++c) hz += diff2(im.rows[y][left * im.s + c], im.rows[y][right * im.s + c]);
+            e[y][x] = v + hz;
+        }
+    }
+    return e;
+}
+
+// the neighbour above x that a path through x comes from (0 left, 1
+// straight, 2 right) given the values of the row above
+static int ref_pick(const std::vector<f32>& above, u32 x)
+{
+    const u32 w = above.size();
+    if (w == 1) return 1;
+    if (x == 0) return above[1] < above[0] ? 2 : 1;
+    if (x == w - 1) return above[w - 2] < above[w - 1] ? 0 : 1;
+
+    int best = 0;
+    if (above[x] < above[x - 1 + best]) best = 1;
+    if (above[x + 1] < above[x - 1 + best]) best = 2;
+    return best;
+}
+
+// cheapest seam over the whole image
+static ref_seam ref_exact(const std::vector<std::vector<f32>>& e)
+{
+    const u32 h = e.size(), w = e[0].size();
+    std::vector<std::vector<f32>> m = e;
+    std::vector<std::vector<int>> from(h, std::vector<int>(w, 1));
+    for (u32 y = 1; y < h; ++y) {
+        for (u32 x = 0; x < w; ++x) {
+            from[y][x] = ref_pick(m[y - 1], x);
+            m[y][x] = e[y][x] + m[y - 1][x + from[y][x] - 1];
+        }
+    }
+
+    ref_seam s{std::vector<u32>(h), 0};
+    u32 x = 0;
+    for (u32 i = 1; i < w; ++i) if (m[h - 1][i] < m[h - 1][x]) x = i;
+    s.cost = m[h - 1][x];
+    for (u32 y = h; y-- > 0;) {
+        s.xs[y] = x;
+        if (y > 0) x = x + from[y][x] - 1;
+    }
+    return s;
+}
+
+// greedy: from every top pixel follow the choice of each row, taken from
+// the energies of the row above it, keep the cheapest path
+static ref_seam ref_greedy(const std::vector<std::vector<f32>>& e)
+{
+    const u32 h = e.size(), w = e[0].size();
+    auto step = [&](u32 x, u32 y) -> u32 {
+        const int c = y == 0 || w < 3 ? 1 : ref_pick(e[y - 1], x);
+        if (x == 0 && c == 0) return 0;
+        if (x == w - 1 && c == 2) return w - 1;
+        return x + c - 1;
+    };
+
+    ref_seam best{{}, 0};
+    for (u32 x0 = 0; x0 < w; ++x0) {
+        ref_seam s{std::vector<u32>(h), 0};
+        u32 x = x0;
+        for (u32 y = 0; y < h; ++y) {
+            s.xs[y] = x;
+            s.cost += e[y][x];
+            x = step(x, y);
+        }
+        if (x0 == 0 || s.cost < best.cost) best = s;
+    }
+    return best;
+}
+
+static void ref_remove(ref_image& im, const std::vector<u32>& xs)
+{
+    for (u32 y = 0; y < im.h; ++y) {
+        auto& r = im.rows[y];
+        r.erase(r.begin() + xs[y] * im.s, r.begin() + (xs[y] + 1) * im.s);
+    }
+    im.w--;
+}
+
+// 2D: horizontal seams are the exact seams of the transposed energies;
+// the direction follows retarget_order: cheapest searches both
+// directions every step, ratio only the direction that carves
+static void ref_remove_rows(ref_image& im, const std::vector<u32>& ys)
+{
+    for (u32 x = 0; x < im.w; ++x) {
+        for (u32 y = ys[x]; y + 1 < im.h; ++y) {
+            std::copy_n(&im.rows[y + 1][x * im.s], im.s, &im.rows[y][x * im.s]);
+        }
+    }
+    im.rows.pop_back();
+    im.h--;
+}
+
+static ref_seam ref_horizontal(const std::vector<std::vector<f32>>& e)
+{
+    std::vector<std::vector<f32>> t(e[0].size(), std::vector<f32>(e.size()));
+    for (u32 y = 0; y < e.size(); ++y) {
+        for (u32 x = 0; x < e[0].size(); ++x) t[x][y] = e[y][x];
+    }
+    return ref_exact(t);
+}
+
+static ref_image ref_retarget(const buffer_view<u8>& b, u32 tw, u32 th, retarget_order order, f64* energy, u32* horizontal)
+{
+    ref_image im = to_ref(b);
+    const u32 columns = im.w - tw, rows = im.h - th;
+    while (im.w > tw || im.h > th) {
+        auto e = ref_energy(im);
+        ref_seam v, hz;
+        b32 vertical;
+        if (im.w == tw) vertical = 0;
+        else if (im.h == th) vertical = 1;
+        else if (order == RETARGET_RATIO) vertical = (u64)(columns - (im.w - tw)) * rows <= (u64)(rows - (im.h - th)) * columns;
+        else {
+            v = ref_exact(e);
+            hz = ref_horizontal(e);
+            vertical = v.cost / im.h <= hz.cost / im.w;
+        }
+        if (vertical && v.xs.empty()) v = ref_exact(e);
+        if (!vertical && hz.xs.empty()) hz = ref_horizontal(e);
+
+        if (vertical) {
+            ref_remove(im, v.xs);
+            *energy += v.cost;
+        } else {
+            ref_remove_rows(im, hz.xs);
+            *energy += hz.cost;
+            (*horizontal)++;
+        }
+    }
+    return im;
+}
+
+// --- paths ---------------------------------------------------------------
+
+// What a path did: the seams when it can tell, and the carved image.
+struct trace {
+    std::vector<ref_seam> seams;
+    f64 energy = 0;
+    ref_image image;
+};
+
+static trace ref_carve(const buffer_view<u8>& b, u32 seams, seam_mode mode, std::vector<ref_image>* states = nullptr)
+{
+    trace t;
+    t.image = to_ref(b);
+    if (states) states->push_back(t.image);
+    for (u32 i = 0; i < seams && t.image.w > 1; ++i) {
+        auto e = ref_energy(t.image);
+        ref_seam s = mode == SEAM_EXACT ? ref_exact(e) : ref_greedy(e);
+        ref_remove(t.image, s.xs);
+        t.energy += s.cost;
+        t.seams.push_back(s);
+        if (states) states->push_back(t.image);
+    }
+    return t;
+}
+
+struct test_image {
+    std::string name;
+    buffer<u8> pixels;
+};
+
+struct path {
+    std::string name;
+    seam_mode mode;
+    std::function<trace(test_image&, u32 seams)> run;
+    f64 ms = 0;
+    u32 failures = 0;
+};
+
+static trace carve_view(test_image& t, u32 seams, seam_mode mode, choice_storage storage)
+{
+    buffer<u8> b = t.pixels;
+    buffer_view<u8> v = view(b);
+    carve_workspace ws;
+    ws.mode = mode;
+    ws.storage = storage;
+    reserve(ws, width(v), height(v));
+
+    trace r;
+    for (u32 i = 0; i < seams && width(v) > 1; ++i) {
+        ref_seam s;
+        remove_seam(v, ws, &s.cost);
+        s.xs.assign(pixels(ws.seam), pixels(ws.seam) + height(v));
+        r.energy += s.cost;
+        r.seams.push_back(s);
+    }
+    r.image = to_ref(v);
+    return r;
+}
+
+template <typename I>
+static trace carve_lazy(test_image& t, u32 seams, seam_mode mode)
+{
+    buffer<u8> b = t.pixels;
+    index_map<I> m{view(b)};
+    carve_workspace ws;
+    ws.mode = mode;
+    reserve(ws, width(m), height(m));
+
+    trace r;
+    std::vector<u32> removed(height(m));
+    for (u32 i = 0; i < seams && width(m) > 1; ++i) {
+        ref_seam s;
+        remove_seam(m, ws, &s.cost, removed.data());
+        s.xs.assign(pixels(ws.seam), pixels(ws.seam) + height(m));
+        r.energy += s.cost;
+        r.seams.push_back(s);
+    }
+    buffer<u8> out{width(m), height(m), width(m) * bpp(m), bpp(m)};
+    buffer_view<u8> ov = view(out);
+    materialize(m, ov);
+    r.image = to_ref(ov);
+    return r;
+}
+
+// whole carves, only the image and the energy can be compared
+static trace carve_whole(test_image& t, u32 seams, seam_mode mode,
+                         std::function<void(buffer_view<u8>&, u32, carve_workspace&, carve_stats&)> f)
+{
+    buffer<u8> b = t.pixels;
+    buffer_view<u8> v = view(b);
+    carve_workspace ws;
+    ws.mode = mode;
+    carve_stats cs;
+    f(v, width(v) > seams ? width(v) - seams : 1, ws, cs);
+
+    trace r;
+    r.energy = cs.energy;
+    r.image = to_ref(v);
+    return r;
+}
+
+// --- images --------------------------------------------------------------
+
+static u32 seed = 12345;
+
+static u32 next_random()
+{
+    seed = seed * 1103515245u + 12345u;
+    return seed >> 8;
+}
+
+static test_image make_image(const char* kind, u32 w, u32 h, u32 s, std::function<u8(u32 x, u32 y, u32 c)> f)
+{
+    char name[96];
+    snprintf(name, sizeof(name), "%s %ux%u bpp %u", kind, w, h, s);
+    // padded rows, so paths that ignore the pitch show up
+    test_image t{name, buffer<u8>{w, h, w * s + 5, s}};
+    for (u32 y = 0; y < h; ++y) {
+        for (u32 x = 0; x < w; ++x) {
+            for (u32 c = 0; c < s; ++c) row(t.pixels, y)[x * s + c] = f(x, y, c);
+        }
+    }
+    return t;
+}
+
+static std::vector<test_image> make_images()
+{
+    std::vector<test_image> images;
+    auto random = [](u32, u32, u32) { return (u8)next_random(); };
+    auto two = [](u32, u32, u32) { return (u8)(next_random() & 1); };
+
+    for (u32 i = 0; i < 40; ++i) {
+        static const u32 bpps[] = {1, 3, 4};
+        u32 w = 1 + next_random() % 48, h = 1 + next_random() % 32, s = bpps[next_random() % 3];
+        images.push_back(make_image("random", w, h, s, random));
+    }
+    for (u32 w : {1u, 2u, 3u}) {
+        for (u32 h : {1u, 2u, 7u}) {
+            images.push_back(make_image("narrow", w, h, 3, random));
+            images.push_back(make_image("narrow flat", w, h, 1, [](u32, u32, u32) { return (u8)9; }));
+        }
+    }
+    images.push_back(make_image("flat", 17, 11, 3, [](u32, u32, u32) { return (u8)128; }));
+    images.push_back(make_image("ties", 23, 19, 1, two));
+    images.push_back(make_image("ties", 31, 9, 3, two));
+    images.push_back(make_image("stripes", 20, 12, 3, [](u32 x, u32, u32) { return (u8)(x % 2 ? 255 : 0); }));
+    images.push_back(make_image("checker", 16, 16, 1, [](u32 x, u32 y, u32) { return (u8)((x + y) % 2 ? 200 : 10); }));
+    images.push_back(make_image("gradient", 25, 14, 3, [](u32 x, u32 y, u32 c) { return (u8)(x * 10 + c); }));
+    images.push_back(make_image("flat middle", 24, 10, 3, [](u32 x, u32, u32) {
+        return (u8)(x < 4 || x > 19 ? next_random() : 77);
+    }));
+    images.push_back(make_image("edge columns", 18, 13, 3, [](u32 x, u32, u32) {
+        return (u8)(x == 0 || x == 17 ? 0 : 100 + next_random() % 100);
+    }));
+    images.push_back(make_image("one row", 40, 1, 3, random));
+    // past the 256 pixel chunks of the packed choices and the SIMD tails
+    images.push_back(make_image("wide", 301, 7, 1, random));
+    images.push_back(make_image("wide ties", 263, 6, 3, two));
+    return images;
+}
+
+// --- comparing -----------------------------------------------------------
+
+static std::string compare(const trace& ref, const trace& got)
+{
+    char msg[160];
+    if (!got.seams.empty()) {
+        for (size_t i = 0; i < ref.seams.size(); ++i) {
+            if (i >= got.seams.size()) return "missing seams";
+            for (size_t y = 0; y < ref.seams[i].xs.size(); ++y) {
+                if (ref.seams[i].xs[y] != got.seams[i].xs[y]) {
+                    snprintf(msg, sizeof(msg), "seam %zu row %zu: x %u, reference %u",
+                             i, y, got.seams[i].xs[y], ref.seams[i].xs[y]);
+                    return msg;
+                }
+            }
+            if (ref.seams[i].cost != got.seams[i].cost) {
+                snprintf(msg, sizeof(msg), "seam %zu: cost %.9g, reference %.9g", i, got.seams[i].cost, ref.seams[i].cost);
+                return msg;
+            }
+        }
+    }
+    if (ref.energy != got.energy) {
+        snprintf(msg, sizeof(msg), "energy %.9g, reference %.9g", got.energy, ref.energy);
+        return msg;
+    }
+    if (ref.image.w != got.image.w || ref.image.h != got.image.h) {
+        snprintf(msg, sizeof(msg), "size %ux%u, reference %ux%u", got.image.w, got.image.h, ref.image.w, ref.image.h);
+        return msg;
+    }
+    for (u32 y = 0; y < ref.image.h; ++y) {
+        if (ref.image.rows[y] != got.image.rows[y]) {
+            snprintf(msg, sizeof(msg), "pixels differ in row %u", y);
+            return msg;
+        }
+    }
+    return "";
+}
+
+static b32 same_image(const ref_image& a, const buffer_view<u8>& b)
+{
+    if (a.w != width(b) || a.h != height(b)) return 0;
+    for (u32 y = 0; y < a.h; ++y) {
+        if (memcmp(a.rows[y].data(), row(b, y), a.w * a.s)) return 0;
+    }
+    return 1;
+}
+
+static f64 ms_since(std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - t).count();
+}
+
+static u32 failures = 0;
+
+static void report(const std::string& name, const char* status, f64 ms)
+{
+    printf("  %-38s %-4s %9.2f ms\n", name.c_str(), status, ms);
+}
+
+static void fail(const std::string& path, const test_image& t, const std::string& what)
+{
+    printf("FAIL %-38s %-24s %s\n", path.c_str(), t.name.c_str(), what.c_str());
+    failures++;
+}
+
+// seam_order renders and seam_stack undo/redo against the reference states
+static void check_order_and_stack(std::vector<test_image>& images)
+{
+    f64 order_ms = 0, stack_ms = 0;
+
+    for (test_image& t : images) {
+        const u32 seams = width(t.pixels) / 2;
+        std::vector<ref_image> states;
+        ref_carve(view(t.pixels), seams, SEAM_EXACT, &states);
+
+        auto start = std::chrono::steady_clock::now();
+        {
+            seam_order o(view(t.pixels), width(t.pixels) - seams);
+            while (o.narrowest() > width(t.pixels) - (states.size() - 1)) std::this_thread::yield();
+
+            buffer<u8> out{width(t.pixels), height(t.pixels), width(t.pixels) * bpp(t.pixels), bpp(t.pixels)};
+            for (size_t i = states.size(); i-- > 0;) {
+                buffer_view<u8> ov = view(out);
+                set_width(ov, o.render(width(t.pixels) - i, ov));
+                if (!same_image(states[i], ov)) {
+                    fail("seam_order", t, "render differs after " + std::to_string(i) + " seams");
+                    break;
+                }
+            }
+        }
+        order_ms += ms_since(start);
+
+        start = std::chrono::steady_clock::now();
+        buffer<u8> b = t.pixels;
+        buffer_view<u8> v = view(b);
+        carve_workspace ws;
+        reserve(ws, width(v), height(v));
+        seam_stack stack;
+        for (u32 i = 0; i < seams && width(v) > 1; ++i) {
+            find_seam(v, ws);
+            stack.push(v, pixels(ws.seam));
+            remove_seam(v, pixels(ws.seam));
+        }
+        // in batches of 1, 2, 3... seams, each compared with its state
+        u32 removed = undo_count(stack);
+        for (u32 n = 1; removed > 0; ++n) {
+            removed -= stack.undo(v, n);
+            if (!same_image(states[removed], v)) {
+                fail("seam_stack undo", t, "differs with " + std::to_string(removed) + " seams left");
+                break;
+            }
+        }
+        for (u32 n = 1; redo_count(stack) > 0; ++n) {
+            removed += stack.redo(v, n);
+            if (!same_image(states[removed], v)) {
+                fail("seam_stack redo", t, "differs after " + std::to_string(removed) + " seams");
+                break;
+            }
+        }
+        const u32 last = std::min(undo_count(stack), 1u);
+        if (stack.undo(v, 1) != last || stack.redo(v, 2) != last || !same_image(states.back(), v)) {
+            fail("seam_stack redo", t, "not the carved image");
+        }
+        stack_ms += ms_since(start);
+    }
+    report("seam_order render", "", order_ms);
+    report("seam_stack undo/redo", "", stack_ms);
+}
+
+// carve_region on a region inside a larger image: the region carves like
+// the image of just its pixels, everything around it stays
+static void check_regions(std::vector<test_image>& images)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (test_image& t : images) {
+        const u32 w = width(t.pixels), h = height(t.pixels), s = bpp(t.pixels);
+        test_image outer = make_image("around", w + 6, h + 4, s, [](u32, u32, u32) { return (u8)next_random(); });
+        for (u32 y = 0; y < h; ++y) memcpy(row(outer.pixels, y + 2) + 3 * s, row(t.pixels, y), w * s);
+        buffer<u8> before = outer.pixels;
+
+        const u32 seams = w / 2;
+        trace ref = ref_carve(view(t.pixels), seams, SEAM_EXACT);
+
+        carve_workspace ws;
+        const u32 nw = carve_region(outer.pixels, 3, 2, w, h, seams, ws);
+        buffer_view<u8> region{outer.pixels, 3, 2, nw, h};
+        if (!same_image(ref.image, region)) fail("carve_region", t, "region differs");
+
+        for (u32 y = 0; y < h + 4; ++y) {
+            const b32 inside = y >= 2 && y < h + 2;
+            const u8* a = row(before, y);
+            const u8* b = row(outer.pixels, y);
+            if (inside ? memcmp(a, b, 3 * s) || memcmp(a + (3 + w) * s, b + (3 + w) * s, 3 * s)
+                       : memcmp(a, b, (w + 6) * s)) {
+                fail("carve_region", t, "pixels outside the region moved in row " + std::to_string(y));
+                break;
+            }
+        }
+    }
+    report("carve_region", "", ms_since(start));
+}
+
+// retarget in both orders against the 2D reference, a third of each side
+static void check_retarget(std::vector<test_image>& images)
+{
+    const char* names[] = {"retarget cheapest", "retarget ratio"};
+    f64 ms[2] = {};
+
+    for (test_image& t : images) {
+        const u32 w = width(t.pixels), h = height(t.pixels);
+        const u32 tw = std::max(1u, w - w / 3), th = std::max(1u, h - h / 3);
+        for (retarget_order order : {RETARGET_CHEAPEST, RETARGET_RATIO}) {
+            f64 energy = 0;
+            u32 horizontal = 0;
+            ref_image ref = ref_retarget(view(t.pixels), tw, th, order, &energy, &horizontal);
+
+            buffer<u8> b = t.pixels;
+            buffer_view<u8> v = view(b);
+            retarget_workspace ws;
+            carve_stats cs;
+            auto start = std::chrono::steady_clock::now();
+            retarget(v, tw, th, order, ws, &cs);
+            ms[order] += ms_since(start);
+
+            if (!same_image(ref, v)) fail(names[order], t, "pixels differ");
+            else if (cs.energy != energy) fail(names[order], t, "energy differs");
+            else if (cs.horizontal != horizontal) fail(names[order], t, "horizontal seams differ");
+        }
+    }
+    report(names[0], "", ms[0]);
+    report(names[1], "", ms[1]);
+}
+
+// A new empty file in $TMPDIR or /tmp, so parallel checks don't share it.
+static std::string temp_path()
+{
+    const char* dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    std::string path = std::string(dir) + "/check_carve-XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0) {
+        perror(path.c_str());
+        exit(1);
+    }
+    close(fd);
+    return path;
+}
+
+// carve_file through PPM and PGM files, with caps from one row per band
+// up to the whole image, tracing from spilled choices and checkpoints
+static void check_bands(std::vector<test_image>& images)
+{
+    const std::string in = temp_path(), out = temp_path();
+    f64 ms = 0;
+    u32 banded = 0;
+
+    for (test_image& t : images) {
+        const u32 w = width(t.pixels), h = height(t.pixels), s = bpp(t.pixels);
+        if (s == 4) continue;
+        const u32 seams = w / 2 + (w > 2);
+        trace ref = ref_carve(view(t.pixels), seams, SEAM_EXACT);
+
+        {
+            std::ofstream f(in, std::ios::binary);
+            f << (s == 3 ? "P6" : "P5") << "\n# check\n" << w << " " << h << "\n255\n";
+            for (u32 y = 0; y < h; ++y) f.write((const char*)row(t.pixels, y), w * s);
+        }
+
+        static const u64 caps[] = {512u, 1024u, 2048u, 4096u, 1u << 20};
+        for (u32 i = 0; i < 10; ++i) {
+            band_options options;
+            options.memory = caps[i % 5];
+            options.checkpoints = i >= 5;
+            const std::string name = options.checkpoints ? "carve_file checkpoints" : "carve_file";
+            carve_stats cs;
+            band_report r;
+            auto start = std::chrono::steady_clock::now();
+            int err = carve_file(in.c_str(), out.c_str(), w - seams, options, &cs, &r);
+            ms += ms_since(start);
+            if (err == BAND_MEMORY) continue;
+            if (err) {
+                fail(name, t, "error " + std::to_string(err));
+                break;
+            }
+            banded += r.bands > 1;
+
+            std::ifstream f(out, std::ios::binary);
+            std::string magic;
+            u32 ow, oh, maxval;
+            f >> magic >> ow >> oh >> maxval;
+            f.get();
+            ref_image got{ow, oh, s, std::vector<std::vector<u8>>(oh, std::vector<u8>(ow * s))};
+            for (auto& row : got.rows) f.read((char*)row.data(), row.size());
+
+            trace tr;
+            tr.energy = cs.energy;
+            tr.image = got;
+            std::string what = compare(ref, tr);
+            if (!f || !what.empty()) {
+                fail(name, t, (f ? what : "short output") + " with " + std::to_string(r.band_rows) + " rows per band");
+                break;
+            }
+        }
+    }
+    remove(in.c_str());
+    remove(out.c_str());
+    if (!banded) {
+        printf("FAIL carve_file never ran in more than one band\n");
+        failures++;
+    }
+    report("carve_file", "", ms);
+}
+
+// carve_strips: one strip is a plain carve; with several, every row is
+// the original row with `removed` pixels taken out, and a strip too
+// narrow for its share hands the rest to the others
+static void check_strips(std::vector<test_image>& images)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (test_image& t : images) {
+        const u32 w = width(t.pixels), h = height(t.pixels), s = bpp(t.pixels);
+        const u32 seams = w / 2;
+
+        buffer<u8> one = t.pixels;
+        trace ref = ref_carve(view(t.pixels), seams, SEAM_EXACT);
+        const u32 removed = carve_strips(one, seams, 1, 0);
+        if (removed != ref.seams.size() || !same_image(ref.image, view(one))) {
+            fail("carve_strips", t, "one strip differs from a carve");
+        }
+
+        for (u32 strips : {3u, w / 4}) {
+            buffer<u8> b = t.pixels;
+            const u32 n = std::max<u32>(1, std::min<u32>(strips, w / 4));
+
+            // one column on each side of an inner boundary stays, and one
+            // more column always
+            u32 room = 0;
+            for (u32 i = 0; i < n; ++i) {
+                const u32 x0 = u64(w) * i / n, x1 = u64(w) * (i + 1) / n;
+                const u32 pinned = (x0 > 0) + (x1 < w) + 1;
+                room += x1 - x0 > pinned ? x1 - x0 - pinned : 0;
+            }
+
+            const u32 got = carve_strips(b, seams, strips, 2);
+            if (got != std::min(seams, room) || width(b) != w - got) {
+                fail("carve_strips", t, std::to_string(strips) + " strips removed " + std::to_string(got) +
+                     " of " + std::to_string(seams) + " seams, room for " + std::to_string(room));
+                continue;
+            }
+            for (u32 y = 0; y < h; ++y) {
+                const u8* a = row(t.pixels, y);
+                const u8* c = row(b, y);
+                u32 x = 0;
+                for (u32 i = 0; i < w && x < width(b); ++i) {
+                    if (!memcmp(a + i * s, c + x * s, s)) x++;
+                }
+                if (x != width(b)) {
+                    fail("carve_strips", t, "row " + std::to_string(y) + " is not the original minus seams");
+                    break;
+                }
+            }
+        }
+    }
+    report("carve_strips", "", ms_since(start));
+}
+
+// a workspace reserved for one mode and storage, then switched between
+// seams, as the daemon does per request
+static void check_mode_switch(std::vector<test_image>& images)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (test_image& t : images) {
+        if (width(t.pixels) < 3) continue;
+        buffer<u8> b = t.pixels;
+        buffer_view<u8> v = view(b);
+        carve_workspace ws;
+        ws.storage = CHOICE_NONE;
+        reserve(ws, width(v), height(v));
+
+        ref_image ref = to_ref(v);
+        for (seam_mode mode : {SEAM_GREEDY, SEAM_EXACT}) {
+            auto e = ref_energy(ref);
+            ref_seam rs = mode == SEAM_EXACT ? ref_exact(e) : ref_greedy(e);
+            ref_remove(ref, rs.xs);
+
+            ws.mode = mode;
+            ws.storage = mode == SEAM_EXACT ? CHOICE_BYTES : CHOICE_PACKED;
+            remove_seam(v, ws);
+        }
+        if (!same_image(ref, v)) fail("mode switch", t, "pixels differ");
+    }
+    report("mode switch", "", ms_since(start));
+}
+
+// carve_hybrid against resample_width, checked on its own below, and
+// the reference carve, in either order
+static void check_hybrid(std::vector<test_image>& images)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (test_image& t : images) {
+        const u32 w = width(t.pixels), h = height(t.pixels), s = bpp(t.pixels);
+        const u32 target = std::max(1u, w / 3);
+        if (target >= w) continue;
+
+        for (b32 carve_first : {0, 1}) {
+            for (seam_mode mode : {SEAM_GREEDY, SEAM_EXACT}) {
+                hybrid_split split;
+                split.carved = 0.25f;
+                split.carve_first = carve_first;
+                const u32 seams = (u32)std::lround(0.25f * (w - target));
+
+                ref_image ref;
+                if (carve_first) {
+                    ref_image carved = ref_carve(view(t.pixels), seams, mode).image;
+                    buffer<u8> b{carved.w, h, carved.w * s, s};
+                    for (u32 y = 0; y < h; ++y) memcpy(row(b, y), carved.rows[y].data(), carved.w * s);
+                    buffer_view<u8> v = view(b);
+                    resample_width(v, target);
+                    ref = to_ref(v);
+                } else {
+                    buffer<u8> b = t.pixels;
+                    buffer_view<u8> v = view(b);
+                    resample_width(v, target + seams);
+                    ref = ref_carve(v, seams, mode).image;
+                }
+
+                buffer<u8> b = t.pixels;
+                buffer_view<u8> v = view(b);
+                carve_workspace ws;
+                ws.mode = mode;
+                carve_stats cs;
+                const u32 got = carve_hybrid(v, target, split, ws, &cs);
+
+                std::string name = std::string("carve_hybrid 0.25 ") + (carve_first ? "carve first " : "") +
+                                   seam_mode_name(mode);
+                if (got != target || cs.seams != seams || cs.resampled != w - target - seams) {
+                    fail(name, t, "width " + std::to_string(got) + ", " + std::to_string(cs.seams) + " seams, " +
+                         std::to_string(cs.resampled) + " resampled");
+                } else if (!same_image(ref, v)) {
+                    fail(name, t, "pixels differ");
+                }
+            }
+        }
+    }
+    report("carve_hybrid 0.25, both orders", "", ms_since(start));
+}
+
+// carve_within with no time resamples all of the width; with a tight
+// budget it carves some, resamples the rest and ends within a seam of the
+// budget, with one more seam of slack for the resample estimate and timer
+// noise
+static void check_deadline(std::vector<test_image>& images)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (test_image& t : images) {
+        const u32 w = width(t.pixels), target = w / 2;
+        if (!target) continue;
+        buffer<u8> b = t.pixels;
+        buffer_view<u8> v = view(b);
+        carve_workspace ws;
+        carve_stats cs;
+        const u32 got = carve_within(v, target, 0, ws, &cs);
+        if (got != target || width(v) != target || cs.seams || cs.resampled != w - target) {
+            fail("carve_within budgets", t, "no budget gave width " + std::to_string(got) + ", " +
+                 std::to_string(cs.seams) + " seams and " + std::to_string(cs.resampled) + " resampled");
+        }
+    }
+
+    test_image t = make_image("random", 480, 320, 3, [](u32, u32, u32) { return (u8)next_random(); });
+    const u32 w = width(t.pixels), target = w / 2;
+    f64 carve_ms, seam_ms;
+    {
+        buffer<u8> b = t.pixels;
+        buffer_view<u8> v = view(b);
+        carve_workspace ws;
+        auto t0 = std::chrono::steady_clock::now();
+        remove_seam(v, ws);
+        seam_ms = ms_since(t0);
+        carve_within(v, target, 1e9f, ws);
+        carve_ms = ms_since(t0);
+    }
+    for (f64 part : {0.25, 0.5}) {
+        buffer<u8> b = t.pixels;
+        buffer_view<u8> v = view(b);
+        carve_workspace ws;
+        carve_stats cs;
+        const f64 budget = carve_ms * part;
+        auto t0 = std::chrono::steady_clock::now();
+        const u32 got = carve_within(v, target, budget / 1e3, ws, &cs);
+        const f64 took = ms_since(t0);
+
+        char what[160];
+        snprintf(what, sizeof(what), "%.2f ms budget: width %u, %u seams, %u resampled, %.2f ms", budget, got,
+                 cs.seams, cs.resampled, took);
+        if (got != target || cs.seams + cs.resampled != w - target || !cs.seams || !cs.resampled) {
+            fail("carve_within budgets", t, what);
+        } else if (took > budget + 2 * seam_ms) {
+            fail("carve_within budgets", t, std::string(what) + ", a seam is " + std::to_string(seam_ms) + " ms");
+        }
+    }
+    report("carve_within budgets", "", ms_since(start));
+}
+
+// min3_row and argmin3_row for both cost types at every SIMD level, on
+// rows of every length around the vector widths, with few distinct
+// values so there are ties, and misaligned
+template <typename Cost>
+static void check_min3(const char* type)
+{
+    f64 ms[SIMD_AVX2 + 1] = {};
+    for (u32 n = 0; n <= 70; ++n) {
+        std::vector<Cost> prev(n + 3), add(n + 1), out(n + 1);
+        std::vector<u8> choice(n + 1);
+        for (Cost& c : prev) c = (Cost)(next_random() % 4);
+        for (Cost& c : add) c = (Cost)(next_random() % 100);
+
+        std::vector<Cost> want(n);
+        std::vector<u8> want_choice(n);
+        for (u32 i = 0; i < n; ++i) {
+            const Cost* p = &prev[1 + i];
+            u8 c = 0;
+            if (p[1] < p[c]) c = 1;
+            if (p[2] < p[c]) c = 2;
+            want_choice[i] = c;
+            want[i] = add[1 + i] + p[c];
+        }
+
+        for (int l = SIMD_SCALAR; l <= detect_simd(); ++l) {
+            set_simd((simd_level)l);
+            const std::string name = std::string("min3 ") + type + " " + simd_name((simd_level)l);
+            const std::string at = "length " + std::to_string(n);
+
+            std::fill(choice.begin(), choice.end(), 9);
+            auto start = std::chrono::steady_clock::now();
+            argmin3_row(&prev[1], &choice[1], n);
+            ms[l] += ms_since(start);
+            if (!std::equal(want_choice.begin(), want_choice.end(), choice.begin() + 1)) {
+                printf("FAIL %-38s %-24s argmin3_row differs\n", name.c_str(), at.c_str());
+                failures++;
+            }
+
+            std::fill(choice.begin(), choice.end(), 9);
+            start = std::chrono::steady_clock::now();
+            min3_row(&prev[1], &add[1], &out[1], &choice[1], n);
+            ms[l] += ms_since(start);
+            if (!std::equal(want_choice.begin(), want_choice.end(), choice.begin() + 1) ||
+                !std::equal(want.begin(), want.end(), out.begin() + 1)) {
+                printf("FAIL %-38s %-24s min3_row differs\n", name.c_str(), at.c_str());
+                failures++;
+            }
+        }
+        set_simd(detect_simd());
+    }
+    for (int l = SIMD_SCALAR; l <= detect_simd(); ++l) {
+        report(std::string("min3 ") + type + " " + simd_name((simd_level)l), "", ms[l]);
+    }
+}
+
+// every SIMD level gives the scalar bytes, and all stay within one of an
+// area filter in doubles
+static void check_resample(std::vector<test_image> images)
+{
+    f64 ms[SIMD_AVX2 + 1] = {};
+
+    // wide enough for the vector paths at large ratios too
+    for (u32 s : {1u, 3u, 4u}) {
+        images.push_back(make_image("wide random", 257, 3, s, [](u32, u32, u32) { return (u8)next_random(); }));
+    }
+
+    for (test_image& t : images) {
+        const u32 w = width(t.pixels), h = height(t.pixels), s = bpp(t.pixels);
+        for (u32 nw : {1u, std::max(1u, w / 7), std::max(1u, w / 3), std::max(1u, w - 1)}) {
+            ref_image ref = to_ref(view(t.pixels));
+            const f64 r = (f64)w / nw;
+            for (u32 y = 0; y < h; ++y) {
+                for (u32 x = 0; x < nw; ++x) {
+                    for (u32 c = 0; c < s; ++c) {
+                        f64 sum = 0;
+                        for (u32 i = 0; i < w; ++i) {
+                            const f64 lo = std::max(x * r, (f64)i), hi = std::min((x + 1) * r, (f64)i + 1);
+                            if (hi > lo) sum += (hi - lo) * row(t.pixels, y)[i * s + c];
+                        }
+                        ref.rows[y][x * s + c] = (u8)std::lround(sum / r);
+                    }
+                }
+                ref.rows[y].resize(nw * s);
+            }
+            ref.w = nw;
+
+            buffer<u8> scalar;
+            for (int l = SIMD_SCALAR; l <= detect_simd(); ++l) {
+                set_simd((simd_level)l);
+                buffer<u8> b = t.pixels;
+                buffer_view<u8> v = view(b);
+                auto start = std::chrono::steady_clock::now();
+                resample_width(v, nw);
+                ms[l] += ms_since(start);
+
+                if (l == SIMD_SCALAR) scalar = b;
+                b32 close = 1, same = 1;
+                for (u32 y = 0; y < h; ++y) {
+                    for (u32 i = 0; i < nw * s; ++i) {
+                        close &= std::abs(row(b, y)[i] - ref.rows[y][i]) <= 1;
+                        same &= row(b, y)[i] == row(scalar, y)[i];
+                    }
+                }
+                std::string name = std::string("resample ") + simd_name((simd_level)l);
+                if (!same) fail(name, t, "differs from scalar at width " + std::to_string(nw));
+                else if (!close) fail(name, t, "off by more than one at width " + std::to_string(nw));
+            }
+            set_simd(detect_simd());
+        }
+    }
+    for (int l = SIMD_SCALAR; l <= detect_simd(); ++l) {
+        report(std::string("resample ") + simd_name((simd_level)l), "", ms[l]);
+    }
+}
+
+int main()
+{
+    std::vector<test_image> images = make_images();
+    std::vector<path> paths;
+
+    const char* storage_names[] = {"bytes", "packed", "none"};
+    for (seam_mode mode : {SEAM_GREEDY, SEAM_EXACT}) {
+        for (int st = CHOICE_BYTES; st <= CHOICE_NONE; ++st) {
+            for (int l = SIMD_SCALAR; l <= detect_simd(); ++l) {
+                paths.push_back({std::string("remove_seam ") + seam_mode_name(mode) + " " + storage_names[st] + " " +
+                                 simd_name((simd_level)l), mode,
+                                 [mode, st, l](test_image& t, u32 seams) {
+                                     set_simd((simd_level)l);
+                                     trace r = carve_view(t, seams, mode, (choice_storage)st);
+                                     set_simd(detect_simd());
+                                     return r;
+                                 }});
+            }
+        }
+        const std::string m = seam_mode_name(mode);
+        paths.push_back({"index_map<u16> " + m, mode, [mode](test_image& t, u32 seams) {
+            return carve_lazy<u16>(t, seams, mode);
+        }});
+        paths.push_back({"index_map<u32> " + m, mode, [mode](test_image& t, u32 seams) {
+            return carve_lazy<u32>(t, seams, mode);
+        }});
+        paths.push_back({"carve " + m, mode, [mode](test_image& t, u32 seams) {
+            return carve_whole(t, seams, mode, [](buffer_view<u8>& v, u32 target, carve_workspace& ws, carve_stats& cs) {
+                carve(v, target, ws, &cs);
+            });
+        }});
+        paths.push_back({"carve_targets " + m, mode, [mode](test_image& t, u32 seams) {
+            // the image handed to emit for the narrowest target
+            buffer<u8> b = t.pixels, last;
+            buffer_view<u8> v = view(b);
+            const u32 w = width(v), target = w > seams ? w - seams : 1;
+            carve_workspace ws;
+            ws.mode = mode;
+            carve_stats cs;
+            carve_targets(v, {w, (w + target) / 2, target}, ws, [&](const buffer_view<u8>& image, u32) {
+                last = copy(image);
+            }, &cs);
+
+            trace r;
+            r.energy = cs.energy;
+            r.image = to_ref(view(last));
+            return r;
+        }});
+        paths.push_back({"carve_within " + m, mode, [mode](test_image& t, u32 seams) {
+            return carve_whole(t, seams, mode, [](buffer_view<u8>& v, u32 target, carve_workspace& ws, carve_stats& cs) {
+                carve_within(v, target, 1e9f, ws, &cs);
+            });
+        }});
+        paths.push_back({"carve_hybrid " + m, mode, [mode](test_image& t, u32 seams) {
+            return carve_whole(t, seams, mode, [](buffer_view<u8>& v, u32 target, carve_workspace& ws, carve_stats& cs) {
+                hybrid_split split;
+                split.carved = 1;
+                carve_hybrid(v, target, split, ws, &cs);
+            });
+        }});
+    }
+
+    printf("%zu images, reference against:\n", images.size());
+
+    f64 ref_ms[2] = {};
+    for (test_image& t : images) {
+        const u32 seams = width(t.pixels) / 2 + (width(t.pixels) > 2);
+        for (seam_mode mode : {SEAM_GREEDY, SEAM_EXACT}) {
+            auto start = std::chrono::steady_clock::now();
+            trace ref = ref_carve(view(t.pixels), seams, mode);
+            ref_ms[mode] += ms_since(start);
+
+            for (path& p : paths) {
+                if (p.mode != mode) continue;
+                start = std::chrono::steady_clock::now();
+                trace got = p.run(t, seams);
+                p.ms += ms_since(start);
+
+                std::string what = compare(ref, got);
+                if (!what.empty()) {
+                    fail(p.name, t, what);
+                    p.failures++;
+                }
+            }
+        }
+    }
+
+    report("reference greedy", "", ref_ms[SEAM_GREEDY]);
+    report("reference exact", "", ref_ms[SEAM_EXACT]);
+    for (const path& p : paths) {
+        report(p.name, p.failures ? "FAIL" : "ok", p.ms);
+    }
+
+    check_min3<f32>("f32");
+    check_min3<s32>("s32");
+    check_order_and_stack(images);
+    check_regions(images);
+    check_resample(images);
+    check_hybrid(images);
+    check_retarget(images);
+    check_bands(images);
+    check_strips(images);
+    check_mode_switch(images);
+    check_deadline(images);
+
+    if (failures) {
+        printf("%u divergences\n", failures);
+        return 1;
+    }
+    printf("all paths match the reference\n");
+    return 0;
+}
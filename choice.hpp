@@ -0,0 +1,65 @@
+#ifndef CHOICE_HPP
+#define CHOICE_HPP
+
+// Storage for the path choices (0 left, 1 straight, 2 right), either a
+// byte per pixel in any buffer or two bits per pixel in a packed_view.
+
+#include "types.hpp"
+#include "tbuffer.hpp"
+
+template <ReadBuffer C> inline
+u8 choice_at(const C& c, u32 x, u32 y) { return row(c, y)[x * bpp(c)]; }
+
+template <WriteBuffer C> inline
+void set_choice(C& c, u32 x, u32 y, u8 v) { row(c, y)[x * bpp(c)] = v; }
+
+// Four choices to a byte, lowest bits first. Does not own the bits, so
+// like buffer_view it can cover the first w columns of larger storage.
+class packed_view {
+public:
+    packed_view(u8* bits, u32 w, u32 h, u32 p) : w(w), h(h), p(p), bits(bits) {}
+
+    // bytes per row for w pixels
+    static constexpr u32 row_bytes(u32 w) { return (w + 3) / 4; }
+
+    friend constexpr inline u32 height(const packed_view& b) { return b.h; }
+    friend constexpr inline u32 width(const packed_view& b) { return b.w; }
+    friend constexpr inline u32 pitch(const packed_view& b) { return b.p; }
+    friend constexpr inline u8* pixels(const packed_view& b) { return b.bits; }
+
+private:
+    u32 w;
+    u32 h;
+    u32 p; // bytes per row
+    u8* bits;
+};
+
+inline u8* row(const packed_view& c, u32 y) { return pixels(c) + (size_t)y * pitch(c); }
+
+inline u8 choice_at(const packed_view& c, u32 x, u32 y)
+{
+    return (row(c, y)[x >> 2] >> ((x & 3) * 2)) & 3;
+}
+
+inline void set_choice(packed_view& c, u32 x, u32 y, u8 v)
+{
+    u8& b = row(c, y)[x >> 2];
+    const u32 shift = (x & 3) * 2;
+    b = (b & ~(3 << shift)) | (v << shift);
+}
+
+// Packs the w byte choices of a row into row y of c.
+inline void pack_row(packed_view& c, u32 y, const u8* choices)
+{
+    const u32 w = width(c);
+    u8* dst = row(c, y);
+    for (u32 x = 0; x < w; x += 4) {
+        u8 b = choices[x];
+        if (x+1 < w) b |= choices[x+1] << 2;
+        if (x+2 < w) b |= choices[x+2] << 4;
+        if (x+3 < w) b |= choices[x+3] << 6;
+        dst[x >> 2] = b;
+    }
+}
+
+#endif
@@ -0,0 +1,142 @@
+// Client for the carve daemon.
+//
+//     client [-s socket] stats
+//     client [-s socket] carve -w width [-m mode] [-t ms] [-x fraction] in out   daemon reads and writes the files
+//     client [-s socket] send -w width [-m mode] [-t ms] [-x fraction] in out    image bytes go over the socket
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "protocol.hpp"
+
+static int connect_to(const char* path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (connect(fd, (sockaddr*)&addr, sizeof(addr))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int read_file(const char* filename, std::vector<u8>& data)
+{
+    FILE* f = fopen(filename, "rb");
+    if (!f) return 1;
+    u8 chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data.insert(data.end(), chunk, chunk + n);
+    fclose(f);
+    return 0;
+}
+
+static int write_file(const char* filename, const std::vector<u8>& data)
+{
+    FILE* f = fopen(filename, "wb");
+    if (!f) return 1;
+    size_t n = fwrite(data.data(), 1, data.size(), f);
+    return fclose(f) || n != data.size();
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: client [-s socket] stats\n"
+                    "       client [-s socket] carve|send -w width [-m exact|greedy] [-t deadline-ms] [-x carved-fraction] in out\n");
+}
+
+int main(int argc, char* argv[])
+{
+    const char* path = DEFAULT_SOCKET;
+    u32 target_width = 0;
+    const char* mode = nullptr;
+    u32 deadline_ms = 0;
+    const char* hybrid = nullptr;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "+s:")) != -1) {
+        if (opt == 's') path = optarg;
+        else { usage(); return 1; }
+    }
+    if (optind >= argc) {
+        usage();
+        return 1;
+    }
+    std::string command = argv[optind];
+    optind++;
+    while ((opt = getopt(argc, argv, "w:m:t:x:")) != -1) {
+        if (opt == 'w') target_width = atoi(optarg);
+        else if (opt == 'm') mode = optarg;
+        else if (opt == 't') deadline_ms = atoi(optarg);
+        else if (opt == 'x') hybrid = optarg;
+        else { usage(); return 1; }
+    }
+
+    int fd = connect_to(path);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+
+    std::string line;
+
+    if (command == "stats") {
+        write_line(fd, "STATS");
+        while (!read_line(fd, line) && line != "END") printf("%s\n", line.c_str());
+        return 0;
+    }
+
+    if ((command != "carve" && command != "send") || argc - optind != 2 || !target_width) {
+        usage();
+        return 1;
+    }
+
+    const char* in = argv[optind];
+    const char* out = argv[optind+1];
+    std::string request = "CARVE width=" + std::to_string(target_width);
+    if (mode) request += std::string(" mode=") + mode;
+    if (deadline_ms) request += " deadline=" + std::to_string(deadline_ms);
+    if (hybrid) request += std::string(" hybrid=") + hybrid;
+
+    if (command == "carve") {
+        write_line(fd, request + " in=" + in + " out=" + out);
+    } else {
+        std::vector<u8> data;
+        if (read_file(in, data)) {
+            perror(in);
+            return 1;
+        }
+        write_line(fd, request + " bytes=" + std::to_string(data.size()));
+        write_full(fd, data.data(), data.size());
+    }
+
+    if (read_line(fd, line)) {
+        fprintf(stderr, "no reply\n");
+        return 1;
+    }
+    printf("%s\n", line.c_str());
+
+    message m = parse_message(line);
+    if (m.command != "OK") return 1;
+
+    if (u64 size = option(m, "bytes")) {
+        std::vector<u8> png(size);
+        if (read_full(fd, png.data(), size) || write_file(out, png)) {
+            perror(out);
+            return 1;
+        }
+    }
+
+    close(fd);
+    return 0;
+}
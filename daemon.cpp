@@ -0,0 +1,261 @@
+// Carve daemon: serves carve requests over a Unix domain socket from a
+// pool of workers that keep their workspaces between requests.
+// See protocol.hpp for the wire format.
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "seamcarve.hpp"
+#include "imageio.hpp"
+#include "pipeline.hpp"
+#include "protocol.hpp"
+
+// largest inline image accepted
+const u64 MAX_REQUEST_BYTES = 256u << 20;
+
+// a read from a client that sends nothing for this long fails
+const int READ_TIMEOUT_S = 10;
+
+struct connection {
+    int fd;
+    pipeline_clock::time_point accepted;
+};
+
+struct daemon_stats {
+    std::atomic<u64> requests{0};
+    std::atomic<u64> errors{0};
+    std::atomic<u64> rejected{0};
+    std::atomic<u64> seams{0};      // columns carved
+    std::atomic<u64> resampled{0};  // columns resampled for deadlines
+    std::atomic<f32> encode_ns{30}; // per output pixel, running mean of the encodes
+    latency_histogram queued;   // accept until a worker picks it up
+    latency_histogram carving;  // decode, carve and encode
+    latency_histogram total;    // accept until the reply is written
+};
+
+static const char* socket_path = DEFAULT_SOCKET;
+static u32 max_width = 4096, max_height = 4096;
+
+static void on_signal(int)
+{
+    unlink(socket_path);
+    _exit(0);
+}
+
+static std::string format_stats(daemon_stats& stats, bounded_queue<connection>& queue, u32 workers)
+{
+    char line[256];
+    snprintf(line, sizeof(line), "workers %u\nqueued %u\nrequests %llu\nerrors %llu\nrejected %llu\n"
+             "seams %llu\nresampled %llu\n",
+             workers, queue.size(), (unsigned long long)stats.requests.load(),
+             (unsigned long long)stats.errors.load(), (unsigned long long)stats.rejected.load(),
+             (unsigned long long)stats.seams.load(), (unsigned long long)stats.resampled.load());
+    return line + stats.queued.format("queue") + stats.carving.format("carve") + stats.total.format("total");
+}
+
+// Returns the reply line, fills png when the result goes back inline and
+// cs with what the carve did.
+static std::string carve_request(int fd, const message& m, carve_workspace& ws, std::vector<u8>& png,
+                                 pipeline_clock::time_point accepted, daemon_stats& stats, carve_stats& cs)
+{
+    const u64 width_option = option(m, "width");
+    const u64 deadline_option = option(m, "deadline");
+    const u64 size = option(m, "bytes");
+    const auto in = m.options.find("in");
+    const auto out = m.options.find("out");
+    const auto hybrid = m.options.find("hybrid");
+    const auto first = m.options.find("first");
+
+    // a payload over the limit is not read at all, serve shuts the
+    // reading side down; one that fits comes off the socket before any
+    // other error goes back
+    std::vector<u8> data;
+    if (size > MAX_REQUEST_BYTES) return "ERR request too large";
+    if (size) {
+        data.resize(size);
+        if (read_full(fd, data.data(), size)) return "ERR short read";
+    }
+
+    if (!width_option) return "ERR missing width";
+    if (width_option > max_width) return "ERR bad width";
+    if (deadline_option > UINT32_MAX) return "ERR bad deadline";
+    const u32 target_width = width_option;
+    const u32 deadline_ms = deadline_option;
+
+    const auto mode = m.options.find("mode");
+    ws.mode = SEAM_EXACT;
+    if (mode != m.options.end() && parse_seam_mode(mode->second.c_str(), &ws.mode)) {
+        return "ERR unknown mode " + mode->second;
+    }
+
+    buffer<u8> image;
+    if (size) {
+        if (load_image(image, data.data(), size)) return "ERR can't decode";
+        data = std::vector<u8>();
+    } else if (in != m.options.end()) {
+        if (load_image(image, in->second.c_str())) return "ERR can't decode " + in->second;
+    } else {
+        return "ERR missing in or bytes";
+    }
+
+    buffer_view<u8> v = view(image);
+    if (deadline_ms) {
+        // what is left of the deadline after queueing and decoding, less
+        // the encode
+        const f32 encode = stats.encode_ns.load() * 1e-9f * std::min(target_width, width(image)) * height(image);
+        f32 left = std::max(0.0f, deadline_ms / 1000.0f - seconds_since(accepted) - encode);
+        set_width(image, carve_within(v, target_width, left, ws, &cs));
+    } else if (hybrid != m.options.end()) {
+        hybrid_split split;
+        split.carved = atof(hybrid->second.c_str());
+        split.carve_first = first != m.options.end() && first->second == "carve";
+        set_width(image, carve_hybrid(v, target_width, split, ws, &cs));
+    } else {
+        set_width(image, carve(v, target_width, ws, &cs));
+    }
+
+    char info[160];
+    snprintf(info, sizeof(info), " mode=%s seams=%u energy=%.0f resampled=%u ms=%.3f",
+             seam_mode_name(ws.mode), cs.seams, cs.energy, cs.resampled, cs.seconds * 1000.0f);
+    std::string reply = "OK width=" + std::to_string(width(image)) + " height=" + std::to_string(height(image)) + info;
+
+    const auto encoding = pipeline_clock::now();
+    if (out != m.options.end()) {
+        if (save_image(image, out->second.c_str())) return "ERR can't encode " + out->second;
+    } else {
+        if (save_image(image, png)) return "ERR can't encode";
+        reply += " bytes=" + std::to_string(png.size());
+    }
+
+    // racing workers may each drop the other's update, it is an estimate
+    const f32 ns = seconds_since(encoding) * 1e9f / ((f32)width(image) * height(image));
+    stats.encode_ns = 0.75f * stats.encode_ns.load() + 0.25f * ns;
+    return reply;
+}
+
+static void serve(connection c, carve_workspace& ws, daemon_stats& stats,
+                  bounded_queue<connection>& queue, u32 workers)
+{
+    stats.queued.add(seconds_since(c.accepted));
+
+    std::string line;
+    if (read_line(c.fd, line)) {
+        close(c.fd);
+        return;
+    }
+
+    message m = parse_message(line);
+    if (m.command == "STATS") {
+        std::string text = format_stats(stats, queue, workers);
+        write_full(c.fd, text.data(), text.size());
+        write_line(c.fd, "END");
+    } else if (m.command == "CARVE") {
+        stats.requests++;
+        auto t = pipeline_clock::now();
+        std::vector<u8> png;
+        carve_stats cs;
+        std::string reply = carve_request(c.fd, m, ws, png, c.accepted, stats, cs);
+        stats.carving.add(seconds_since(t));
+        stats.seams += cs.seams;
+        stats.resampled += cs.resampled;
+
+        if (reply.compare(0, 2, "OK") != 0) stats.errors++;
+        if (!write_line(c.fd, reply) && !png.empty()) {
+            write_full(c.fd, png.data(), png.size());
+        }
+        stats.total.add(seconds_since(c.accepted));
+    } else {
+        write_line(c.fd, "ERR unknown command");
+    }
+
+    // drops what the client still sends, the reply is out already
+    shutdown(c.fd, SHUT_RD);
+    close(c.fd);
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: daemon [-s socket] [-j workers] [-q queue] [-W max-width] [-H max-height]\n");
+}
+
+int main(int argc, char* argv[])
+{
+    u32 workers = std::max(1u, std::thread::hardware_concurrency());
+    u32 queue_length = 64;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:j:q:W:H:")) != -1) {
+        switch (opt) {
+            case 's': socket_path = optarg; break;
+            case 'j': workers = std::max(1, atoi(optarg)); break;
+            case 'q': queue_length = std::max(1, atoi(optarg)); break;
+            case 'W': max_width = atoi(optarg); break;
+            case 'H': max_height = atoi(optarg); break;
+            default: usage(); return 1;
+        }
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+    unlink(socket_path);
+
+    if (bind(listener, (sockaddr*)&addr, sizeof(addr)) || listen(listener, 128)) {
+        perror(socket_path);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    bounded_queue<connection> queue(queue_length);
+    daemon_stats stats;
+
+    std::vector<std::thread> pool;
+    for (u32 i = 0; i < workers; ++i) {
+        pool.emplace_back([&] {
+            // warm workspace, grows past max size only when needed
+            carve_workspace ws;
+            reserve(ws, max_width, max_height);
+
+            connection c;
+            while (queue.pop(c)) {
+                serve(c, ws, stats, queue, workers);
+            }
+        });
+    }
+
+    printf("listening on %s with %u workers\n", socket_path, workers);
+    fflush(stdout);
+
+    for (;;) {
+        int fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) continue;
+
+        // a client that stops sending can't keep a worker
+        timeval timeout = {READ_TIMEOUT_S, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        connection c{fd, pipeline_clock::now()};
+        if (!queue.try_push(c)) {
+            // back-pressure: tell the client now instead of queueing forever
+            stats.rejected++;
+            write_line(fd, "BUSY");
+            close(fd);
+        }
+    }
+}
@@ -1,292 +1,111 @@
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "../stb/stb_image.h"
 #include <iostream>
 #include <cassert>
 #include <limits>
+#include <memory>
 #include <queue>
+#include <thread>
 #include <unordered_map>
 #include <utility>
 
-typedef uint32_t u32;
-typedef int32_t  s32;
-typedef uint32_t b32;
-typedef uint8_t u8;
-typedef float f32;
+#include "types.hpp"
 
 const int WINDOW_WIDTH = 1920;
 const int WINDOW_HEIGHT = 1080;
+const size_t UNDO_BUDGET = 256 << 20;  // bytes of removed seams kept for U
 
 #include <SDL.h>
 #include "math.hpp"
 
 //#include "buffer.hpp"
-#include "tbuffer.hpp"
-
-int load_image(buffer<u8>& ret, const char* filename)
-{
-    int x, y, cif, dc=0;
-
-    stbi_uc* image;
-    image = stbi_load(filename, &x, &y, &cif, dc);
-    if (!image) {
-        std::cout << "ERROR\n";
-        return 1;
-    }
-
-    std::cout << "x:" << x << ", y: " << y << ", cif: " << cif << "\n";
-
-    buffer<u8> b{x, y, x*cif, cif};
-
-    size_t buffer_size = (size_t)(pitch(b)*height(b));
-    std::cout << "buffer_size: " << buffer_size << "\n";
-    std::copy_n((u8*)image, buffer_size, row(b, u32(0)));
-
-    stbi_image_free(image);
-
-    ret = b;
-
-    return 0;
-}
+#include "seamcarve.hpp"
+#include "seam_order.hpp"
+#include "seam_stack.hpp"
+#include "imageio.hpp"
 
 struct game_memory {
     float time;
     int running;
     int remove;
+    int strips;             // carve 50 seams in parallel strips, 2 to compare
+    int undo;               // seams to put back (U) or remove again (Y, negative)
     rect2 viewport;
     v2 scale;
     buffer<u8> original;
-    buffer<f32> edges;
-    buffer<u8> choice;
+    carve_workspace ws;
+    buffer_view<u8> region; // part of original that gets carved
+    b32 region_at_edge;     // region touches the right edge of original
     u32 last_x;
+    std::unique_ptr<seam_order> order;  // seams of original, for dragging
+    u32 target;             // width to show original at while dragging, 0 for all of it
+    b32 changed;            // original was carved, order is out of date
+    buffer<u8> resized;
+    seam_stack removed{UNDO_BUDGET};
 };
 
-// should return sum of squares of differences between channels
-// (R(p1) - R(p0))^2 + (G(p1) - G(p0))^2 + (B(p1) - B(p0))^2
-f32 edge(u8 x, u8 y)
-{
-    f32 a = (f32)x;
-    f32 b = (f32)y;
-    return (b-a) * (b-a);
-}
-
-template <typename T>
-int smallest(T a, T b, T c)
+// Region width changes by dw, and the image with it at the right edge.
+static void resize_region(game_memory* memory, s32 dw)
 {
-    if (b < a) {
-        if (c < b) {
-            return 2;
-        } else {
-            return 1;
-        }
-    } else {
-        if (c < a) {
-            return 2;
-        } else {
-            return 0;
-        }
-    }
-}
-
-template <typename I>
-struct energy {
-    int n;
-    energy(int n) : n(n) {}
-    f32 operator()(I f0, I f1, I f2)
-    {
-        f32 x = 0.0f;
-        for (int i = 0; i < n; ++i) {
-            x += edge(*(f0+i), *(f2+i));
-        }
-        return x;
-    }
-};
-
-template <typename I, typename B, typename N, typename O, typename Op>
-O op_row3_n(I f0, I f1, I f2, B f_s, N n, O out, B o_s, Op op)
-{
-    while (n--) {
-        *out += op(f0, f1, f2);
-        f0 += f_s;
-        f1 += f_s;
-        f2 += f_s;
-        out += o_s;
-    }
-
-    return out;
-}
-
-template <typename T>
-void edge_detect_h(const buffer<T>& in, buffer<f32>& out)
-{
-    // edge detect
-    // energy differentiation
-
-    const u8* src0 = row(in, 0);
-    const u8* src1 = row(in, 1);
-    const u8* src2 = row(in, 2);
-    f32* dst = row(out, 1);
-
-    assert(height(in) > 2);
-    assert(width(in) > 2);
-
-    const u32 h = height(in) - 2;
-
-    for (u32 y = 1; y < h; ++y) {
-        std::fill(dst, dst+pitch(out), 0);
-        dst = op_row3_n(src0, src1, src2, bpp(in), width(in), dst, bpp(out), energy<const u8*>{bpp(in)});
-
-        src0 = src1;
-        src1 = src2;
-        src2 = row(in, y+1);
-
-        dst += pitch(out) - width(out);
-    }
-
-}
-template <typename T>
-void edge_detect_w(const buffer<T>& in, buffer<f32>& out)
-{
-    // edge detect
-    // energy differentiation
-
-    const u8* src0 = row(in, 0);
-    const u8* src1 = row(in, 0)+1;
-    const u8* src2 = row(in, 0)+2;
-
-    const u32 w = width(in) - 2;
-
-    for (u32 x = 1; x < w; ++x) {
-        f32* dst = row(out, 0) + (x+1) * bpp(out);
-
-        op_row3_n(src0, src1, src2, pitch(in), height(in), dst, pitch(out), energy<const u8*>{bpp(in)});
-
-        src0 = src1;
-        src1 = src2;
-        src2 = row(in, 0) + (x+1) * bpp(in);
+    if (memory->region_at_edge) {
+        set_width(memory->original, width(memory->original) + dw);
     }
+    memory->changed = 1;
 }
 
-template <typename T>
-void edge_detect(const buffer<T>& in, buffer<f32>& out)
-{
-    // edge detect
-    // energy differentiation
-    edge_detect_h(in, out);
-    edge_detect_w(in, out);
-}
-
-void find_path(const buffer<f32>& energies, const buffer<u8>& choice, u32 x, f32* sum)
+void GameUpdateAndRender(game_memory* memory, float delta, buffer<u8>& screen)
 {
-    u32 y = 0;
-
-    while (y < height(energies)) {
-        const f32* e_row = row(energies, y);
-        const u8* c_row = row(choice, y);
-        *sum += e_row[x];
-
-        // next x;
-        if (x == 0 && c_row[x] == 0) x = 0;
-        else if (x == width(choice)-1 && c_row[x] == 2) x = width(choice)-1;
-        else {
-            x += c_row[x];
-            x--;
-        }
-
-        // next y
-        y++;
+    if (memory->remove >= 0 && width(memory->region) > 1) {
+        find_seam(memory->region, memory->ws);
+        memory->removed.push(memory->region, pixels(memory->ws.seam));
+        remove_seam(memory->region, pixels(memory->ws.seam));
+        memory->last_x = pixels(memory->ws.seam)[0];
+
+        // a region at the right edge shrinks the image with it
+        resize_region(memory, -1);
+        memory->remove--;
     }
-}
-
-void remove_path(buffer<u8>& image, const buffer<u8>& choice, u32 x)
-{
-    u32 y = 0;
 
-    while (y < height(image)) {
-        u8* i_row = row(image, y);
-        const u8* c_row = row(choice, y);
-
-        // copy row
-        auto f0 = i_row + x * bpp(image);
-        auto f1 = i_row + (x + 1) * bpp(image);
-        auto l  = i_row + pitch(image);
-
-        std::copy(f1, l, f0);
-
-        //assert(c_row[x] == 0 || c_row[x] == 1 || c_row[x] == 2);
-
-        // next x;
-        if (x == 0 && c_row[x] == 0) x = 0;
-        else if (x == width(choice)-1 && c_row[x] == 2) x = width(choice)-1;
-        else {
-            x += c_row[x];
-            x--;
-        }
-
-        // next y
-        y++;
+    // a batch at a time, every row is shifted once
+    if (memory->undo > 0) {
+        resize_region(memory, memory->removed.undo(memory->region, memory->undo));
+    } else if (memory->undo < 0) {
+        resize_region(memory, -(s32)memory->removed.redo(memory->region, -memory->undo));
     }
-}
-
-void calculate_paths(const buffer<f32>& in, buffer<u8>& out)
-{
-    // path of smallest energy
-    for (u32 y = 1; y < height(in)-2; ++y) {
-        const f32* src0 = row(in, y-1);
-        u8* dst = row(out, y) + 1;
-
-        for (u32 x = 1; x < width(out)-2; ++x) {
-            u8 v = smallest(*src0, *(src0+1), *(src0+2));
-            assert(v == 0 || v == 1 || v == 2);
-            *dst = v; // 0, 1, 2
-            src0+=bpp(in);
-            dst+=bpp(out);
+    memory->undo = 0;
+
+    if (memory->strips) {
+        const b32 whole = pixels(memory->region) == pixels(memory->original) && memory->region_at_edge;
+        if (whole) {
+            strip_report r;
+            r.compare = memory->strips == 2;
+            u32 n = std::max(1u, std::thread::hardware_concurrency());
+            carve_strips(memory->original, 50, n, 32, &r);
+            set_width(memory->region, width(memory->original));
+            memory->removed.clear();
+            if (r.compare) {
+                printf("Strips: %u, seams: %u, cost: %f, global cost: %f (%+.2f%%)\n",
+                       r.strips, r.seams, r.strip_cost, r.global_cost,
+                       r.global_cost > 0 ? 100.0f * (r.strip_cost - r.global_cost) / r.global_cost : 0.0f);
+            } else {
+                printf("Strips: %u, seams: %u, cost: %f\n", r.strips, r.seams, r.strip_cost);
+            }
+            memory->changed = 1;
         }
+        memory->strips = 0;
     }
-}
 
-u32 find_minimum_path(const buffer<f32>& in, buffer<u8>& out)
-{
-    buffer<float> sum{width(in), 1, width(in), 1};
-
-    for (u32 x = 0; x < width(out); ++x) {
-        find_path(in, out, x, &row(sum, 0)[x]);
+    // find the seams again once R or S are done with the original
+    if (memory->changed && memory->remove < 0) {
+        memory->order.reset(new seam_order(view(memory->original), 1));
+        memory->changed = 0;
     }
 
-    auto f = row(sum, 0);
-    auto l = row(sum, 0) + width(sum);
-
-    auto m = std::min_element(f, l);
-    u32 x = m - f;
-    return x;
-}
-
-void GameUpdateAndRender(game_memory* memory, float delta, buffer<u8>& screen)
-{
-    auto& edges = memory->edges;
-    auto& choice = memory->choice;
-
-    if (memory->remove >= 0) {
-        std::fill(begin(edges), end(edges), 0);
-
-        edge_detect(memory->original, edges);
-
-        u32 y=0;
-        while (y < height(edges)) {
-            row(edges,y++)[0] = std::numeric_limits<float>::max();
-            row(edges,y++)[width(edges)] = std::numeric_limits<float>::max();
-        }
-
-        calculate_paths(edges, choice);
-        u32 x = find_minimum_path(edges, choice);
-        remove_path(memory->original, choice, x);
-
-        // decrease width of images (pitch stays the same)
-        set_width(memory->original, width(memory->original)-1);
-        set_width(edges, width(edges)-1);
-        set_width(choice, width(choice)-1);
-
-        memory->remove--;
+    // while dragging, the image comes from the seams found so far
+    buffer_view<u8> shown = view(memory->original);
+    if (memory->order && memory->target && memory->target < width(memory->original)) {
+        buffer_view<u8> out = view(memory->resized);
+        set_width(out, memory->order->render(memory->target, out));
+        shown = out;
     }
 
     for (u32 y = 0; y < height(screen); ++y) {
@@ -301,10 +120,10 @@ void GameUpdateAndRender(game_memory* memory, float delta, buffer<u8>& screen)
     }
 
     // draw
-    for (u32 y = 0; y < std::min(height(memory->original), height(screen)); ++y) {
-        const u8* src = row(memory->original, y);
+    for (u32 y = 0; y < std::min(height(shown), height(screen)); ++y) {
+        const u8* src = row(shown, y);
         u8* dst = row(screen, y);
-        for (u32 x = 0; x < std::min(width(memory->original), width(screen)); ++x) {
+        for (u32 x = 0; x < std::min(width(shown), width(screen)); ++x) {
 
             *(dst)   = *(src+2);
             *(dst+1) = *(src+1);
@@ -324,7 +143,7 @@ void GameUpdateAndRender(game_memory* memory, float delta, buffer<u8>& screen)
 
             /* *(dst+3) = 255; */
 
-            src += bpp(memory->original);
+            src += bpp(shown);
             dst += bpp(screen);
         }
     }
@@ -379,7 +198,10 @@ int main(int argc, const char* argv[])
     memory.time = 0.0f;
     memory.running = 1;
     memory.remove = 0;
+    memory.strips = 0;
+    memory.undo = 0;
     memory.last_x = 0;
+    memory.target = 0;
 
     SDL_Rect w;
     SDL_RenderGetViewport(renderer, &w);
@@ -406,24 +228,33 @@ int main(int argc, const char* argv[])
     printf("Viewport: %f %f %f %f\n", ul.x, ul.y, dr.x, dr.y);
 
     const char* filename = argv[1];
-    load_image(memory.original, filename);
+    if (load_image(memory.original, filename)) {
+        std::cout << "ERROR\n";
+        return 1;
+    }
 
-    buffer<f32> edges{
-        width(memory.original),
-        height(memory.original),
-        1*width(memory.original),
-        1
-    };
-    memory.edges = edges;
+    std::cout << "x:" << width(memory.original) << ", y: " << height(memory.original)
+              << ", cif: " << bpp(memory.original) << "\n";
+
+    // optional region to carve: x y w h
+    u32 rx = 0, ry = 0;
+    u32 rw = width(memory.original), rh = height(memory.original);
+    if (argc == 6) {
+        rx = std::min<u32>(atoi(argv[2]), width(memory.original)-1);
+        ry = std::min<u32>(atoi(argv[3]), height(memory.original)-1);
+        rw = std::min<u32>(atoi(argv[4]), width(memory.original)-rx);
+        rh = std::min<u32>(atoi(argv[5]), height(memory.original)-ry);
+    }
+    memory.region = buffer_view<u8>{memory.original, rx, ry, rw, rh};
+    memory.region_at_edge = rx + rw == width(memory.original) && rh == height(memory.original);
 
-    buffer<u8> choice{
-        width(memory.edges),
-        height(memory.edges),
-        1 * width(memory.edges),
-        1,
-    };
+    reserve(memory.ws, rw, rh);
 
-    memory.choice = choice;
+    // dragging shows at most a screen of the image
+    const u32 sw = std::min<u32>(width(memory.original), WINDOW_WIDTH);
+    const u32 sh = std::min<u32>(height(memory.original), WINDOW_HEIGHT);
+    memory.resized = buffer<u8>{sw, sh, sw * bpp(memory.original), bpp(memory.original)};
+    memory.changed = 1;
 
     while (memory.running) {
         SDL_Event event;
@@ -433,6 +264,20 @@ int main(int argc, const char* argv[])
                     /* Quit */
                     memory.running = 0;
                     break;
+                case SDL_KEYDOWN:
+                    if (event.key.keysym.scancode == SDL_SCANCODE_S) {
+                        // shift also compares with a global carve
+                        memory.strips = event.key.keysym.mod & KMOD_SHIFT ? 2 : 1;
+                    }
+                    if (event.key.keysym.scancode == SDL_SCANCODE_U) {
+                        memory.undo = 50;
+                        memory.target = 0;
+                    }
+                    if (event.key.keysym.scancode == SDL_SCANCODE_Y) {
+                        memory.undo = -50;
+                        memory.target = 0;
+                    }
+                    break;
             }
         }
 
@@ -441,15 +286,21 @@ int main(int argc, const char* argv[])
         }
         if (keyboardState[SDL_SCANCODE_R]) {
             memory.remove = 50;
+            memory.target = 0;
         }
 
         int mouse_x;
         int mouse_y;
-        /*u32 mouse_mask = */SDL_GetMouseState(&mouse_x, &mouse_y);
+        u32 mouse_mask = SDL_GetMouseState(&mouse_x, &mouse_y);
 
         v2 pos = {(float)mouse_x, (float)mouse_y};
         pos = scale_inv * pos - memory.viewport.min;
 
+        // dragging moves the right edge of the image to the mouse
+        if (mouse_mask & SDL_BUTTON(SDL_BUTTON_LEFT)) {
+            memory.target = (u32)std::max(1.0f, pos.x);
+        }
+
         u32 now = SDL_GetTicks();
         f32 delta = (float)(now-start)/1000.0f;
         start = now;
@@ -0,0 +1,61 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include "../stb/stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "../stb/stb_image_write.h"
+
+#include "imageio.hpp"
+
+static int copy_image(buffer<u8>& ret, stbi_uc* image, int x, int y, int cif)
+{
+    if (!image) {
+        return 1;
+    }
+
+    // rows padded for the column passes of edge_detect
+    buffer<u8> b{x, y, padded_pitch(x*cif, 1), cif};
+
+    for (u32 r = 0; r < height(b); ++r) {
+        std::copy_n((u8*)image + (size_t)r*x*cif, x*cif, row(b, r));
+    }
+
+    stbi_image_free(image);
+
+    ret = std::move(b);
+
+    return 0;
+}
+
+int load_image(buffer<u8>& ret, const char* filename)
+{
+    int x, y, cif, dc=0;
+    stbi_uc* image = stbi_load(filename, &x, &y, &cif, dc);
+    return copy_image(ret, image, x, y, cif);
+}
+
+int load_image(buffer<u8>& ret, const u8* data, size_t size)
+{
+    int x, y, cif, dc=0;
+    stbi_uc* image = stbi_load_from_memory(data, (int)size, &x, &y, &cif, dc);
+    return copy_image(ret, image, x, y, cif);
+}
+
+int save_image(const buffer<u8>& image, const char* filename)
+{
+    int ok = stbi_write_png(filename, width(image), height(image), bpp(image),
+                            pixels(image), pitch(image));
+    return ok ? 0 : 1;
+}
+
+static void append(void* context, void* data, int size)
+{
+    auto out = (std::vector<u8>*)context;
+    out->insert(out->end(), (u8*)data, (u8*)data + size);
+}
+
+int save_image(const buffer<u8>& image, std::vector<u8>& out)
+{
+    out.clear();
+    int ok = stbi_write_png_to_func(append, &out, width(image), height(image), bpp(image),
+                                    pixels(image), pitch(image));
+    return ok ? 0 : 1;
+}
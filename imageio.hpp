@@ -0,0 +1,17 @@
+#ifndef IMAGEIO_HPP
+#define IMAGEIO_HPP
+
+// Decoding and encoding with stb_image, kept out of libseamcarve.
+
+#include "types.hpp"
+#include "tbuffer.hpp"
+
+#include <vector>
+
+// All return 0 on success.
+int load_image(buffer<u8>& ret, const char* filename);
+int load_image(buffer<u8>& ret, const u8* data, size_t size);
+int save_image(const buffer<u8>& image, const char* filename);
+int save_image(const buffer<u8>& image, std::vector<u8>& out);
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef INDEX_MAP_HPP
+#define INDEX_MAP_HPP
+
+// Lazy seam removal: every row keeps the columns of the untouched
+// original that are still in the image. Removing a seam only moves
+// indices, the pixels are copied once by materialize.
+
+#include "types.hpp"
+#include "tbuffer.hpp"
+
+// I is u16 for originals narrower than 65536 pixels, u32 otherwise.
+template <typename I>
+class index_map {
+public:
+    typedef I index_type;
+
+    index_map() {}
+
+    explicit index_map(const buffer_view<u8>& original)
+        : original(original),
+          index{width(original), height(original), width(original), 1}
+    {
+        for (u32 y = 0; y < height(index); ++y) {
+            I* r = row(index, y);
+            for (u32 x = 0; x < width(index); ++x) r[x] = x;
+        }
+    }
+
+    friend inline u32 height(const index_map& m) { return height(m.index); }
+    friend inline u32 width(const index_map& m) { return width(m.index); }
+    friend inline u32 bpp(const index_map& m) { return bpp(m.original); }
+
+    // pixel at (x, y) of the carved image
+    friend inline const u8* pixel(const index_map& m, u32 x, u32 y) {
+        return row(m.original, y) + row(m.index, y)[x] * bpp(m.original);
+    }
+
+public:
+    buffer_view<u8> original;
+    buffer<I> index;   // width shrinks with every seam
+};
+
+// Copies the carved image to out, which is at least as large. out may be
+// the original itself, indices only grow along a row.
+template <typename I>
+void materialize(const index_map<I>& m, buffer_view<u8>& out)
+{
+    const u32 s = bpp(m);
+    for (u32 y = 0; y < height(m); ++y) {
+        u8* dst = row(out, y);
+        for (u32 x = 0; x < width(m); ++x) {
+            const u8* src = pixel(m, x, y);
+            for (u32 c = 0; c < s; ++c) *dst++ = src[c];
+        }
+    }
+}
+
+#endif
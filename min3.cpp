@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MIN3_X86 1
+#include <immintrin.h>
+#endif
+
+#include "min3.hpp"
+
+template <bool Cost, typename T>
+static inline void min3_scalar(const T* prev, const T* add, T* out, u8* choice, u32 n)
+{
+    for (u32 i = 0; i < n; ++i) {
+        T a = prev[i], b = prev[i+1], c = prev[i+2];
+        u8 k = b < a ? 1 : 0;
+        T m = b < a ? b : a;
+        if (c < m) {
+            k = 2;
+            m = c;
+        }
+        choice[i] = k;
+        if (Cost) out[i] = add[i] + m;
+    }
+}
+
+// The scalar rest of a row from i on. add and out are null without Cost,
+// so they are only offset when there is a cost to add.
+template <bool Cost, typename T>
+static inline void min3_tail(const T* prev, const T* add, T* out, u8* choice, u32 i, u32 n)
+{
+    if (Cost) min3_scalar<Cost>(prev + i, add + i, out + i, choice + i, n - i);
+    else min3_scalar<Cost, T>(prev + i, nullptr, nullptr, choice + i, n - i);
+}
+
+#ifdef MIN3_X86
+
+// four int lanes of 0, 1 or 2 to four bytes
+static inline void store_choice4(u8* choice, __m128i k)
+{
+    k = _mm_packs_epi32(k, k);
+    k = _mm_packus_epi16(k, k);
+    s32 v = _mm_cvtsi128_si32(k);
+    memcpy(choice, &v, 4);
+}
+
+static inline __m128i blend(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+template <bool Cost>
+static void min3_sse2(const f32* prev, const f32* add, f32* out, u8* choice, u32 n)
+{
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i two = _mm_set1_epi32(2);
+
+    u32 i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 a = _mm_loadu_ps(prev + i);
+        __m128 b = _mm_loadu_ps(prev + i + 1);
+        __m128 c = _mm_loadu_ps(prev + i + 2);
+
+        __m128 mb = _mm_cmplt_ps(b, a);
+        __m128 m = _mm_or_ps(_mm_and_ps(mb, b), _mm_andnot_ps(mb, a));
+        __m128i k = _mm_and_si128(_mm_castps_si128(mb), one);
+
+        __m128 mc = _mm_cmplt_ps(c, m);
+        m = _mm_or_ps(_mm_and_ps(mc, c), _mm_andnot_ps(mc, m));
+        k = blend(_mm_castps_si128(mc), two, k);
+
+        if (Cost) _mm_storeu_ps(out + i, _mm_add_ps(m, _mm_loadu_ps(add + i)));
+        store_choice4(choice + i, k);
+    }
+    min3_tail<Cost>(prev, add, out, choice, i, n);
+}
+
+template <bool Cost>
+static void min3_sse2(const s32* prev, const s32* add, s32* out, u8* choice, u32 n)
+{
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i two = _mm_set1_epi32(2);
+
+    u32 i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(prev + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(prev + i + 1));
+        __m128i c = _mm_loadu_si128((const __m128i*)(prev + i + 2));
+
+        __m128i mb = _mm_cmpgt_epi32(a, b);
+        __m128i m = blend(mb, b, a);
+        __m128i k = _mm_and_si128(mb, one);
+
+        __m128i mc = _mm_cmpgt_epi32(m, c);
+        m = blend(mc, c, m);
+        k = blend(mc, two, k);
+
+        if (Cost) {
+            __m128i s = _mm_add_epi32(m, _mm_loadu_si128((const __m128i*)(add + i)));
+            _mm_storeu_si128((__m128i*)(out + i), s);
+        }
+        store_choice4(choice + i, k);
+    }
+    min3_tail<Cost>(prev, add, out, choice, i, n);
+}
+
+// eight int lanes of 0, 1 or 2 to eight bytes
+__attribute__((target("avx2")))
+static inline void store_choice8(u8* choice, __m256i k)
+{
+    __m128i lo = _mm256_castsi256_si128(k);
+    __m128i hi = _mm256_extracti128_si256(k, 1);
+    __m128i b = _mm_packs_epi32(lo, hi);
+    b = _mm_packus_epi16(b, b);
+    _mm_storel_epi64((__m128i*)choice, b);
+}
+
+template <bool Cost>
+__attribute__((target("avx2")))
+static void min3_avx2(const f32* prev, const f32* add, f32* out, u8* choice, u32 n)
+{
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i two = _mm256_set1_epi32(2);
+
+    u32 i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 a = _mm256_loadu_ps(prev + i);
+        __m256 b = _mm256_loadu_ps(prev + i + 1);
+        __m256 c = _mm256_loadu_ps(prev + i + 2);
+
+        __m256 mb = _mm256_cmp_ps(b, a, _CMP_LT_OQ);
+        __m256 m = _mm256_blendv_ps(a, b, mb);
+        __m256i k = _mm256_and_si256(_mm256_castps_si256(mb), one);
+
+        __m256 mc = _mm256_cmp_ps(c, m, _CMP_LT_OQ);
+        m = _mm256_blendv_ps(m, c, mc);
+        k = _mm256_blendv_epi8(k, two, _mm256_castps_si256(mc));
+
+        if (Cost) _mm256_storeu_ps(out + i, _mm256_add_ps(m, _mm256_loadu_ps(add + i)));
+        store_choice8(choice + i, k);
+    }
+    min3_tail<Cost>(prev, add, out, choice, i, n);
+}
+
+template <bool Cost>
+__attribute__((target("avx2")))
+static void min3_avx2(const s32* prev, const s32* add, s32* out, u8* choice, u32 n)
+{
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i two = _mm256_set1_epi32(2);
+
+    u32 i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(prev + i));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(prev + i + 1));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(prev + i + 2));
+
+        __m256i mb = _mm256_cmpgt_epi32(a, b);
+        __m256i m = _mm256_blendv_epi8(a, b, mb);
+        __m256i k = _mm256_and_si256(mb, one);
+
+        __m256i mc = _mm256_cmpgt_epi32(m, c);
+        m = _mm256_blendv_epi8(m, c, mc);
+        k = _mm256_blendv_epi8(k, two, mc);
+
+        if (Cost) {
+            __m256i s = _mm256_add_epi32(m, _mm256_loadu_si256((const __m256i*)(add + i)));
+            _mm256_storeu_si256((__m256i*)(out + i), s);
+        }
+        store_choice8(choice + i, k);
+    }
+    min3_tail<Cost>(prev, add, out, choice, i, n);
+}
+
+#endif
+
+simd_level detect_simd()
+{
+#ifdef MIN3_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2")) return SIMD_SSE2;
+#endif
+    return SIMD_SCALAR;
+}
+
+static simd_level level = detect_simd();
+
+simd_level current_simd()
+{
+    return level;
+}
+
+void set_simd(simd_level l)
+{
+    level = std::min(l, detect_simd());
+}
+
+const char* simd_name(simd_level l)
+{
+    switch (l) {
+        case SIMD_SCALAR: return "scalar";
+        case SIMD_SSE2: return "sse2";
+        case SIMD_AVX2: return "avx2";
+    }
+    return "?";
+}
+
+template <bool Cost, typename T>
+static void dispatch(const T* prev, const T* add, T* out, u8* choice, u32 n)
+{
+    switch (level) {
+#ifdef MIN3_X86
+        case SIMD_AVX2: min3_avx2<Cost>(prev, add, out, choice, n); return;
+        case SIMD_SSE2: min3_sse2<Cost>(prev, add, out, choice, n); return;
+#endif
+        default: min3_scalar<Cost>(prev, add, out, choice, n); return;
+    }
+}
+
+void argmin3_row(const f32* prev, u8* choice, u32 n)
+{
+    dispatch<false, f32>(prev, nullptr, nullptr, choice, n);
+}
+
+void argmin3_row(const s32* prev, u8* choice, u32 n)
+{
+    dispatch<false, s32>(prev, nullptr, nullptr, choice, n);
+}
+
+void min3_row(const f32* prev, const f32* add, f32* out, u8* choice, u32 n)
+{
+    dispatch<true, f32>(prev, add, out, choice, n);
+}
+
+void min3_row(const s32* prev, const s32* add, s32* out, u8* choice, u32 n)
+{
+    dispatch<true, s32>(prev, add, out, choice, n);
+}
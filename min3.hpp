@@ -0,0 +1,38 @@
+#ifndef MIN3_HPP
+#define MIN3_HPP
+
+// Row kernels for the path search: the minimum of three neighbours above
+// and which one it was (0 left, 1 straight, 2 right), for a whole row at a
+// time. Ties go the same way as smallest(): left before straight before
+// right.
+//
+// For i in [0, n):
+//     choice[i] = argmin(prev[i], prev[i+1], prev[i+2])
+//     out[i]    = add[i] + min(prev[i], prev[i+1], prev[i+2])     (min3_row)
+//
+// so prev has n+2 values. Callers pass prev = row above, add, out and
+// choice at x = 1 to update the interior of a row.
+
+#include "types.hpp"
+
+enum simd_level {
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2,
+};
+
+// Best level the cpu supports.
+simd_level detect_simd();
+
+// Level the kernels below use, at most what the cpu supports. Defaults to
+// detect_simd(). Meant to be set once at startup, or by benchmarks.
+simd_level current_simd();
+void set_simd(simd_level level);
+const char* simd_name(simd_level level);
+
+void argmin3_row(const f32* prev, u8* choice, u32 n);
+void argmin3_row(const s32* prev, u8* choice, u32 n);
+void min3_row(const f32* prev, const f32* add, f32* out, u8* choice, u32 n);
+void min3_row(const s32* prev, const s32* add, s32* out, u8* choice, u32 n);
+
+#endif
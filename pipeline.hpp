@@ -0,0 +1,165 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+// Bounded queues and statistics for the batch pipeline.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "types.hpp"
+
+typedef std::chrono::steady_clock pipeline_clock;
+
+inline f32 seconds_since(pipeline_clock::time_point start)
+{
+    return std::chrono::duration<f32>(pipeline_clock::now() - start).count();
+}
+
+// Time a stage spends working, waiting for input and waiting for room in
+// the next queue.
+struct stage_stats {
+    u32 items = 0;
+    f32 busy = 0;
+    f32 starved = 0;
+    f32 blocked = 0;
+};
+
+// FIFO of at most `capacity` items. push blocks while it is full, pop
+// blocks while it is empty and returns false once it is closed and empty.
+template <typename T>
+class bounded_queue {
+public:
+    explicit bounded_queue(u32 capacity) : capacity(capacity), closed(false) {}
+
+    void push(T item)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        not_full.wait(lock, [this] { return items.size() < capacity; });
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+    }
+
+    // Like push, but returns false instead of waiting when full.
+    bool try_push(T& item)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if (items.size() >= capacity) return false;
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    u32 size()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        return items.size();
+    }
+
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(m);
+        not_empty.wait(lock, [this] { return !items.empty() || closed; });
+        if (items.empty()) return false;
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        closed = true;
+        not_empty.notify_all();
+    }
+
+private:
+    std::mutex m;
+    std::condition_variable not_full;
+    std::condition_variable not_empty;
+    std::deque<T> items;
+    u32 capacity;
+    bool closed;
+};
+
+// Latencies in power of two buckets of microseconds, safe to add to from
+// several threads.
+struct latency_histogram {
+    static const u32 buckets = 32;
+    std::atomic<u64> counts[buckets] = {};
+
+    void add(f32 seconds)
+    {
+        u64 us = (u64)(seconds * 1e6f);
+        u32 b = 0;
+        while (b+1 < buckets && (1ull << (b+1)) <= us) b++;
+        counts[b]++;
+    }
+
+    u64 total() const
+    {
+        u64 n = 0;
+        for (auto& c : counts) n += c;
+        return n;
+    }
+
+    // upper bound in microseconds of the bucket holding quantile q
+    u64 quantile(f32 q) const
+    {
+        u64 n = total(), seen = 0;
+        for (u32 b = 0; b < buckets; ++b) {
+            seen += counts[b];
+            if (n && seen >= q * n) return 1ull << (b+1);
+        }
+        return 0;
+    }
+
+    std::string format(const char* name) const
+    {
+        char line[128];
+        std::string s;
+        snprintf(line, sizeof(line), "%s count %llu p50 <%lluus p90 <%lluus p99 <%lluus\n", name,
+                 (unsigned long long)total(), (unsigned long long)quantile(0.5f),
+                 (unsigned long long)quantile(0.9f), (unsigned long long)quantile(0.99f));
+        s += line;
+        for (u32 b = 0; b < buckets; ++b) {
+            if (!counts[b]) continue;
+            snprintf(line, sizeof(line), "%s bucket <%lluus %llu\n", name,
+                     (unsigned long long)(1ull << (b+1)), (unsigned long long)counts[b].load());
+            s += line;
+        }
+        return s;
+    }
+};
+
+// Counts images between decode and encode, to cap memory.
+class in_flight_limit {
+public:
+    explicit in_flight_limit(u32 n) : n(n) {}
+
+    void acquire()
+    {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [this] { return n > 0; });
+        n--;
+    }
+
+    void release()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        n++;
+        cv.notify_one();
+    }
+
+private:
+    std::mutex m;
+    std::condition_variable cv;
+    u32 n;
+};
+
+#endif
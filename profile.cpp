@@ -0,0 +1,132 @@
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "profile.hpp"
+
+static const char* const STAGE_NAMES[STAGES] = {"energy", "costs", "trace", "remove"};
+static const char* const COUNTER_NAMES[COUNTERS] = {
+    "cycles", "instructions", "L1D misses", "LLC misses", "dTLB misses", "branch misses",
+};
+
+const char* stage_name(carve_stage stage) { return STAGE_NAMES[stage]; }
+const char* counter_name(counter_kind kind) { return COUNTER_NAMES[kind]; }
+
+static u64 cache_miss(u64 cache)
+{
+    return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+// user space of the calling thread, counting from now on
+static int open_counter(u32 type, u64 config)
+{
+    perf_event_attr a;
+    memset(&a, 0, sizeof(a));
+    a.size = sizeof(a);
+    a.type = type;
+    a.config = config;
+    a.exclude_kernel = 1;
+    a.exclude_hv = 1;
+    a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return syscall(SYS_perf_event_open, &a, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+}
+
+// The counters are opened on their own rather than as a group, so the
+// kernel can multiplex them when the PMU has fewer registers; values are
+// scaled by the time each one ran.
+static f64 read_counter(int fd)
+{
+    u64 v[3];
+    if (read(fd, v, sizeof(v)) != sizeof(v) || !v[2]) return 0;
+    return v[2] < v[1] ? (f64)v[0] * v[1] / v[2] : (f64)v[0];
+}
+
+carve_profile::carve_profile()
+{
+    static const struct { u32 type; u64 config; } events[COUNTERS] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D)},
+        {PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL)},
+        {PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_DTLB)},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+
+    error = 0;
+    for (int i = 0; i < COUNTERS; ++i) {
+        fds[i] = open_counter(events[i].type, events[i].config);
+        if (fds[i] < 0 && i == COUNT_CYCLES) error = errno;
+        start[i] = 0;
+    }
+}
+
+carve_profile::~carve_profile()
+{
+    for (int fd : fds) {
+        if (fd >= 0) close(fd);
+    }
+}
+
+void carve_profile::begin(carve_stage)
+{
+    for (int i = 0; i < COUNTERS; ++i) {
+        if (fds[i] >= 0) start[i] = read_counter(fds[i]);
+    }
+    started = std::chrono::steady_clock::now();
+}
+
+void carve_profile::end(carve_stage stage, u64 pixels)
+{
+    stage_totals& t = stages[stage];
+    t.seconds += std::chrono::duration<f64>(std::chrono::steady_clock::now() - started).count();
+    for (int i = 0; i < COUNTERS; ++i) {
+        if (fds[i] >= 0) t.counts[i] += read_counter(fds[i]) - start[i];
+    }
+    t.calls++;
+    t.pixels += pixels;
+}
+
+void carve_profile::add(const carve_profile& other)
+{
+    for (int s = 0; s < STAGES; ++s) {
+        stage_totals& t = stages[s];
+        const stage_totals& o = other.stages[s];
+        t.calls += o.calls;
+        t.pixels += o.pixels;
+        t.seconds += o.seconds;
+        for (int i = 0; i < COUNTERS; ++i) t.counts[i] += o.counts[i];
+    }
+}
+
+void print_profile(FILE* f, const carve_profile& p)
+{
+    if (counters_error(p)) {
+        fprintf(f, "no hardware counters (perf_event_open: %s), times only\n", strerror(counters_error(p)));
+    }
+
+    // misses per pixel
+    static const char* const columns[COUNTERS] = {"", "", "L1D/px", "LLC/px", "dTLB/px", "branch/px"};
+    fprintf(f, "%-7s %8s %10s %9s %6s", "stage", "seams", "ms", "ms/seam", "IPC");
+    for (int i = COUNT_L1D_MISSES; i < COUNTERS; ++i) fprintf(f, " %10s", columns[i]);
+    fprintf(f, "\n");
+
+    for (int s = 0; s < STAGES; ++s) {
+        const stage_totals& t = totals(p, (carve_stage)s);
+        if (!t.calls) continue;
+
+        fprintf(f, "%-7s %8llu %10.2f %9.3f", STAGE_NAMES[s], (unsigned long long)t.calls,
+                t.seconds * 1e3, t.seconds * 1e3 / t.calls);
+        if (has_counter(p, COUNT_CYCLES) && has_counter(p, COUNT_INSTRUCTIONS) && t.counts[COUNT_CYCLES] > 0) {
+            fprintf(f, " %6.2f", t.counts[COUNT_INSTRUCTIONS] / t.counts[COUNT_CYCLES]);
+        } else {
+            fprintf(f, " %6s", "-");
+        }
+        for (int i = COUNT_L1D_MISSES; i < COUNTERS; ++i) {
+            if (has_counter(p, (counter_kind)i) && t.pixels) fprintf(f, " %10.4f", t.counts[i] / t.pixels);
+            else fprintf(f, " %10s", "-");
+        }
+        fprintf(f, "\n");
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+// Hardware counters around the stages of the carve loop, through
+// perf_event_open. Set carve_workspace::profile to collect them; each
+// stage adds its time, counts and pixels once per seam. Counters the
+// kernel or the machine doesn't give (containers, VMs, a high
+// perf_event_paranoid) are left out, the times are always there.
+
+#include <chrono>
+#include <cstdio>
+
+#include "types.hpp"
+
+enum carve_stage {
+    STAGE_ENERGY,   // greedy only, exact seams stream energies into the costs
+    STAGE_COSTS,    // cost rows or greedy choices
+    STAGE_TRACE,    // backtracking or following the cheapest path
+    STAGE_REMOVE,
+    STAGES,
+};
+
+enum counter_kind {
+    COUNT_CYCLES,
+    COUNT_INSTRUCTIONS,
+    COUNT_L1D_MISSES,
+    COUNT_LLC_MISSES,
+    COUNT_DTLB_MISSES,
+    COUNT_BRANCH_MISSES,
+    COUNTERS,
+};
+
+struct stage_totals {
+    u64 calls = 0;
+    u64 pixels = 0;
+    f64 seconds = 0;
+    f64 counts[COUNTERS] = {};
+};
+
+// Counts the thread that creates it; use it from that thread only.
+class carve_profile {
+public:
+    carve_profile();
+    ~carve_profile();
+    carve_profile(const carve_profile&) = delete;
+    carve_profile& operator=(const carve_profile&) = delete;
+
+    void begin(carve_stage stage);
+    void end(carve_stage stage, u64 pixels);
+
+    // adds the totals of another thread's profile
+    void add(const carve_profile& other);
+
+    friend const stage_totals& totals(const carve_profile& p, carve_stage stage) { return p.stages[stage]; }
+    friend b32 has_counter(const carve_profile& p, counter_kind kind) { return p.fds[kind] >= 0; }
+
+    // errno of the cycles counter when it couldn't be opened, or 0
+    friend int counters_error(const carve_profile& p) { return p.error; }
+
+private:
+    int fds[COUNTERS];
+    int error;
+    f64 start[COUNTERS];
+    std::chrono::steady_clock::time_point started;
+    stage_totals stages[STAGES];
+};
+
+const char* stage_name(carve_stage stage);
+const char* counter_name(counter_kind kind);
+
+// A table of the stages: time in total and per seam, IPC and misses per
+// pixel.
+void print_profile(FILE* f, const carve_profile& p);
+
+// Times and counts one stage while in scope, nothing without a profile.
+struct stage_scope {
+    stage_scope(carve_profile* p, carve_stage stage, u64 pixels) : p(p), stage(stage), pixels(pixels) {
+        if (p) p->begin(stage);
+    }
+    ~stage_scope() {
+        if (p) p->end(stage, pixels);
+    }
+
+    carve_profile* p;
+    carve_stage stage;
+    u64 pixels;
+};
+
+#endif
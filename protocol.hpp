@@ -0,0 +1,121 @@
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+// Wire format between daemon and client, over a Unix domain socket.
+//
+// A request is one line of space separated words, the command first and
+// then key=value options:
+//
+//     CARVE width=800 in=/path/in.jpg out=/path/out.png
+//     CARVE width=800 bytes=123456      followed by 123456 bytes of image
+//     STATS
+//
+// CARVE takes mode=exact or mode=greedy, exact by default, and
+// deadline=ms: the time from accepting the connection to the reply that
+// carve and encode have to fit in, the width it has no time for is
+// resampled. Decoding, resampling and encoding are never cut short.
+// hybrid=0.25 carves only that fraction of the columns to remove and
+// resamples the rest, first; first=carve resamples after carving.
+//
+// A width above the daemon's -W or a deadline past 32 bits is an error.
+// An inline image over 256 MB is answered with an error and never read,
+// and a client that sends nothing for 10 s loses its connection.
+//
+// The daemon answers with one line:
+//
+//     OK width=780 height=600 ...           image written to out=
+//     OK width=780 height=600 ... bytes=N   followed by N bytes of PNG
+//     BUSY                              queue full, try again later
+//     ERR <message>
+//
+// where ... is mode, seams, energy removed, columns resampled and ms
+// spent carving. STATS
+// answers with text lines and a final END line.
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "types.hpp"
+
+const char* const DEFAULT_SOCKET = "/tmp/seamcarve.sock";
+
+// Both return 0 on success.
+inline int write_full(int fd, const void* data, size_t size)
+{
+    const char* p = (const char*)data;
+    while (size) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+inline int read_full(int fd, void* data, size_t size)
+{
+    char* p = (char*)data;
+    while (size) {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 1;
+        p += n;
+        size -= n;
+    }
+    return 0;
+}
+
+inline int write_line(int fd, const std::string& line)
+{
+    return write_full(fd, (line + "\n").data(), line.size() + 1);
+}
+
+// Reads up to a newline one byte at a time, so no payload bytes are
+// consumed. Lines are short.
+inline int read_line(int fd, std::string& line, size_t max = 4096)
+{
+    line.clear();
+    char c;
+    while (line.size() < max) {
+        if (read_full(fd, &c, 1)) return 1;
+        if (c == '\n') return 0;
+        line += c;
+    }
+    return 1;
+}
+
+struct message {
+    std::string command;
+    std::map<std::string, std::string> options;
+};
+
+inline message parse_message(const std::string& line)
+{
+    message m;
+    size_t i = 0;
+    while (i < line.size()) {
+        size_t j = line.find(' ', i);
+        if (j == std::string::npos) j = line.size();
+        std::string word = line.substr(i, j - i);
+        if (!word.empty()) {
+            size_t eq = word.find('=');
+            if (m.command.empty() && eq == std::string::npos) m.command = word;
+            else if (eq != std::string::npos) m.options[word.substr(0, eq)] = word.substr(eq + 1);
+        }
+        i = j + 1;
+    }
+    return m;
+}
+
+inline u64 option(const message& m, const char* key, u64 fallback = 0)
+{
+    auto it = m.options.find(key);
+    return it == m.options.end() ? fallback : strtoull(it->second.c_str(), nullptr, 10);
+}
+
+#endif
@@ -0,0 +1,210 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RESAMPLE_X86 1
+#include <immintrin.h>
+#endif
+
+#include "resample.hpp"
+#include "min3.hpp"
+
+// Area filter as taps per output byte: output byte j of a row is
+// sum(weight[k][j] * in[offset[j] + k * bpp]) for k < taps, rounded to
+// nearest. Taps past the end of the row have weight 0 and are clamped to
+// the last pixel.
+struct area_filter {
+    u32 taps;
+    u32 n;                      // output bytes per row
+    u32 vector_n;               // bytes whose taps the vector paths can load
+    b32 near;                   // see shuffle
+    std::vector<s32> offset;
+    std::vector<f32> weight;    // taps rows of n
+    // With near, the offsets of every 4 output bytes are less than 16
+    // bytes past the first one's, packed a byte each: one 16-byte load
+    // and a shuffle per tap read all four.
+    std::vector<u32> shuffle;
+};
+
+static area_filter make_filter(u32 in_w, u32 out_w, u32 s)
+{
+    area_filter f;
+    const f64 r = (f64)in_w / out_w;
+    f.taps = (u32)std::ceil(r) + 1;
+    f.n = out_w * s;
+    f.offset.resize(f.n);
+    f.weight.resize((size_t)f.taps * f.n);
+
+    for (u32 x = 0; x < out_w; ++x) {
+        const f64 a = x * r, b = (x + 1) * r;
+        const u32 x0 = (u32)a;
+        for (u32 c = 0; c < s; ++c) {
+            const u32 j = x * s + c;
+            f.offset[j] = x0 * s + c;
+            for (u32 k = 0; k < f.taps; ++k) {
+                const f64 lo = std::max(a, (f64)(x0 + k)), hi = std::min(b, (f64)(x0 + k + 1));
+                const b32 inside = x0 + k < in_w;
+                f.weight[(size_t)k * f.n + j] = inside && hi > lo ? (f32)((hi - lo) / r) : 0.0f;
+            }
+        }
+    }
+
+    f.near = 1;
+    f.shuffle.resize(f.n / 4);
+    for (u32 g = 0; g < f.n / 4; ++g) {
+        for (u32 i = 0; i < 4; ++i) {
+            const u32 d = f.offset[g * 4 + i] - f.offset[g * 4];
+            if (d > 15) f.near = 0;
+            f.shuffle[g] |= d << (8 * i);
+        }
+    }
+
+    // the last tap of a vector byte has a whole load after it in the row,
+    // 16 bytes or a gathered 4-byte word
+    const u32 row_bytes = in_w * s, load = f.near ? 16 : 4;
+    f.vector_n = 0;
+    while (f.vector_n < f.n && f.offset[f.vector_n] + (f.taps - 1) * s + load <= row_bytes) f.vector_n++;
+    return f;
+}
+
+// offsets of taps past the row, clamped to the last pixel
+static inline s32 tap_offset(const area_filter& f, u32 j, u32 k, u32 s, u32 last)
+{
+    return std::min<s32>(f.offset[j] + k * s, last + (f.offset[j] % s));
+}
+
+// rint rounds to even like the vector conversions and is inlined, where
+// nearbyint is a libm call per byte
+static void filter_scalar(const area_filter& f, const u8* in, u8* out, u32 s, u32 last, u32 j)
+{
+    for (; j < f.vector_n; ++j) {
+        const u8* p = in + f.offset[j];
+        f32 sum = 0;
+        for (u32 k = 0; k < f.taps; ++k) sum = sum + f.weight[(size_t)k * f.n + j] * p[k * s];
+        out[j] = (u8)std::min(255.0f, std::rint(sum));
+    }
+    for (; j < f.n; ++j) {
+        f32 sum = 0;
+        for (u32 k = 0; k < f.taps; ++k) {
+            sum = sum + f.weight[(size_t)k * f.n + j] * in[tap_offset(f, j, k, s, last)];
+        }
+        out[j] = (u8)std::min(255.0f, std::rint(sum));
+    }
+}
+
+#ifdef RESAMPLE_X86
+
+static inline void store_bytes8(u8* out, __m128i lo, __m128i hi)
+{
+    __m128i p = _mm_packs_epi32(lo, hi);
+    _mm_storel_epi64((__m128i*)out, _mm_packus_epi16(p, p));
+}
+
+// Output bytes four at a time, taps loaded one lane at a time.
+static u32 filter_sse2(const area_filter& f, const u8* in, u8* out, u32 s)
+{
+    u32 j = 0;
+    for (; j + 8 <= f.vector_n; j += 8) {
+        __m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+        for (u32 k = 0; k < f.taps; ++k) {
+            const s32* o = &f.offset[j];
+            const u32 d = k * s;
+            __m128i v0 = _mm_setr_epi32(in[o[0] + d], in[o[1] + d], in[o[2] + d], in[o[3] + d]);
+            __m128i v1 = _mm_setr_epi32(in[o[4] + d], in[o[5] + d], in[o[6] + d], in[o[7] + d]);
+            const f32* w = &f.weight[(size_t)k * f.n + j];
+            sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(w), _mm_cvtepi32_ps(v0)));
+            sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(w + 4), _mm_cvtepi32_ps(v1)));
+        }
+        store_bytes8(out + j, _mm_cvtps_epi32(sum0), _mm_cvtps_epi32(sum1));
+    }
+    return j;
+}
+
+// Output bytes eight at a time. Near filters load 16 bytes per tap for
+// each four and shuffle the taps out, the others gather each tap as the
+// 4-byte word it starts.
+__attribute__((target("avx2")))
+static u32 filter_avx2(const area_filter& f, const u8* in, u8* out, u32 s)
+{
+    const __m256i low = _mm256_set1_epi32(0xff);
+    u32 j = 0;
+    for (; j + 8 <= f.vector_n; j += 8) {
+        const f32* w = &f.weight[j];
+        __m256 sum = _mm256_setzero_ps();
+        if (f.near) {
+            const u8* p0 = in + f.offset[j];
+            const u8* p1 = in + f.offset[j + 4];
+            const __m128i m0 = _mm_cvtsi32_si128(f.shuffle[j / 4]);
+            const __m128i m1 = _mm_cvtsi32_si128(f.shuffle[j / 4 + 1]);
+            for (u32 k = 0; k < f.taps; ++k, w += f.n) {
+                __m128i v0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p0 + k * s)), m0);
+                __m128i v1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p1 + k * s)), m1);
+                __m256i v = _mm256_cvtepu8_epi32(_mm_unpacklo_epi32(v0, v1));
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(w), _mm256_cvtepi32_ps(v)));
+            }
+        } else {
+            const __m256i o = _mm256_loadu_si256((const __m256i*)&f.offset[j]);
+            for (u32 k = 0; k < f.taps; ++k, w += f.n) {
+                __m256i v = _mm256_i32gather_epi32((const int*)(in + k * s), o, 1);
+                v = _mm256_and_si256(v, low);
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(w), _mm256_cvtepi32_ps(v)));
+            }
+        }
+        __m256i r = _mm256_cvtps_epi32(sum);
+        store_bytes8(out + j, _mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+    }
+    return j;
+}
+
+#endif
+
+// Taps of the bytes before vector_n never reach past the row, so all
+// paths read them without clamping; only the tail is clamped. Output byte j only reads input bytes at
+// or after j, which keeps scaling a row onto itself safe.
+static void filter_row(const area_filter& f, const u8* in, u8* out, u32 s, u32 last)
+{
+    u32 j = 0;
+    switch (current_simd()) {
+#ifdef RESAMPLE_X86
+        case SIMD_AVX2: j = filter_avx2(f, in, out, s); break;
+        case SIMD_SSE2: j = filter_sse2(f, in, out, s); break;
+#endif
+        default: break;
+    }
+    filter_scalar(f, in, out, s, last, j);
+}
+
+void resample_rows(const buffer_view<u8>& in, buffer_view<u8>& out)
+{
+    assert(width(out) <= width(in) && height(out) <= height(in) && bpp(out) == bpp(in));
+    if (width(out) == 0) return;
+
+    const u32 s = bpp(in);
+    if (width(out) == width(in)) {
+        if (pixels(out) == pixels(in)) return;
+        for (u32 y = 0; y < height(out); ++y) memmove(row(out, y), row(in, y), width(in) * s);
+        return;
+    }
+
+    area_filter f = make_filter(width(in), width(out), s);
+    const u32 last = (width(in) - 1) * s;
+    for (u32 y = 0; y < height(out); ++y) {
+        filter_row(f, row(in, y), row(out, y), s, last);
+    }
+}
+
+u32 resample_width(buffer_view<u8>& image, u32 target_width)
+{
+    target_width = std::max(target_width, 1u);
+    if (target_width >= width(image)) return width(image);
+
+    buffer_view<u8> out = image;
+    set_width(out, target_width);
+    resample_rows(image, out);
+
+    set_width(image, target_width);
+    return target_width;
+}
@@ -0,0 +1,22 @@
+#ifndef RESAMPLE_HPP
+#define RESAMPLE_HPP
+
+// Plain resampling, the fast fallback when there is no time left to carve
+// and the bulk of a hybrid carve: every row is scaled to the new width on
+// its own with an area filter, so the result has the same height. Works
+// on the bytes of the buffer as they are, any pitch and bpp. Vectorized
+// at the SIMD level of min3.hpp.
+
+#include "types.hpp"
+#include "tbuffer.hpp"
+
+// Scales the rows of in down to the width of out, which is at most as
+// wide and as high. Each output pixel is the mean of the input it covers.
+// out may be in itself.
+void resample_rows(const buffer_view<u8>& in, buffer_view<u8>& out);
+
+// Scales the rows of image down to target_width in place. Returns the new
+// width.
+u32 resample_width(buffer_view<u8>& image, u32 target_width);
+
+#endif
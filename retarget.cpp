@@ -0,0 +1,187 @@
+#include <chrono>
+#include <algorithm>
+
+#include "carve.hpp"
+
+// 2D retargeting keeps one energy map for both directions. After a seam
+// is removed from the image and the map, only the energies next to it
+// are computed again, so a switch of direction costs nothing. Picking
+// the cheapest direction builds both cost tables per seam and removes
+// the seam it found; a fixed ratio builds only the one that carves.
+
+void reserve(retarget_workspace& ws, u32 w, u32 h)
+{
+    if (w <= width(ws.energy) && h <= height(ws.energy)) return;
+
+    w = std::max(w, width(ws.energy));
+    h = std::max(h, height(ws.energy));
+
+    ws.energy = buffer<f32>{w, h, padded_pitch(w, sizeof(f32)), 1};
+    ws.vertical = buffer<u8>{packed_view::row_bytes(w), h, packed_view::row_bytes(w), 1};
+    ws.horizontal = buffer<u8>{packed_view::row_bytes(h), w, packed_view::row_bytes(h), 1};
+
+    // two cost rows, one choice row, and a block of energy columns
+    const u32 n = std::max(w, h);
+    ws.costs = buffer<f32>{n, 2 + retarget_workspace::BLOCK, n, 1};
+    ws.choices = buffer<u8>{n, 1, n, 1};
+    ws.xs = buffer<u32>{h, 1, h, 1};
+    ws.ys = buffer<u32>{w, 1, w, 1};
+}
+
+// Vertical seam over the energy map, x of every row to ws.xs. Same
+// search as the exact seams of remove_seam.
+static f32 vertical_seam(const buffer_view<f32>& e, retarget_workspace& ws)
+{
+    const u32 w = width(e), h = height(e);
+    packed_view table{pixels(ws.vertical), w, h, pitch(ws.vertical)};
+    f32* prev = row(ws.costs, 0);
+    f32* cur = row(ws.costs, 1);
+    u8* c = pixels(ws.choices);
+    u32* xs = pixels(ws.xs);
+
+    std::copy_n(row(e, 0), w, prev);
+    for (u32 y = 1; y < h; ++y) {
+        cost_row(prev, row(e, y), cur, c, w);
+        pack_row(table, y, c);
+        std::swap(prev, cur);
+    }
+
+    u32 x = std::min_element(prev, prev + w) - prev;
+    const f32 cost = prev[x];
+    for (u32 y = h; y-- > 0;) {
+        xs[y] = x;
+        if (y > 0) x = x + choice_at(table, x, y) - 1;
+    }
+    return cost;
+}
+
+// Horizontal seam: the same search along the columns, which are gathered
+// a block at a time so the map is still read row by row. y of every
+// column to ws.ys.
+static f32 horizontal_seam(const buffer_view<f32>& e, retarget_workspace& ws)
+{
+    const u32 w = width(e), h = height(e);
+    const u32 block = retarget_workspace::BLOCK;
+    packed_view table{pixels(ws.horizontal), h, w, pitch(ws.horizontal)};
+    f32* prev = row(ws.costs, 0);
+    f32* cur = row(ws.costs, 1);
+    f32* columns = row(ws.costs, 2);
+    u8* c = pixels(ws.choices);
+    u32* ys = pixels(ws.ys);
+
+    for (u32 x0 = 0; x0 < w; x0 += block) {
+        const u32 n = std::min(block, w - x0);
+        gather_columns(e, x0, n, columns);
+
+        for (u32 i = 0; i < n; ++i) {
+            const f32* col = columns + i * h;
+            if (x0 + i == 0) {
+                std::copy_n(col, h, prev);
+                continue;
+            }
+            cost_row(prev, col, cur, c, h);
+            pack_row(table, x0 + i, c);
+            std::swap(prev, cur);
+        }
+    }
+
+    u32 y = std::min_element(prev, prev + h) - prev;
+    const f32 cost = prev[y];
+    for (u32 x = w; x-- > 0;) {
+        ys[x] = y;
+        if (x > 0) y = y + choice_at(table, y, x) - 1;
+    }
+    return cost;
+}
+
+// Energies next to a removed vertical seam: a pixel keeps its energy
+// unless its left or right neighbour changed, or the seam went through a
+// different column in the rows above and below.
+static void update_vertical(const buffer_view<u8>& image, buffer_view<f32>& e, const u32* xs)
+{
+    const u32 w = width(image), h = height(image);
+    for (u32 y = 0; y < h; ++y) {
+        const u32 a = xs[y > 0 ? y-1 : 0], b = xs[y], c = xs[y+1 < h ? y+1 : h-1];
+        const u32 lo = std::min({a, b, c}), hi = std::max({a, b, c});
+        f32* r = row(e, y);
+        for (u32 x = lo > 0 ? lo-1 : 0; x <= std::min(hi, w-1); ++x) r[x] = energy_at(image, x, y);
+    }
+}
+
+// Same for a horizontal seam, along the columns.
+static void update_horizontal(const buffer_view<u8>& image, buffer_view<f32>& e, const u32* ys)
+{
+    const u32 w = width(image), h = height(image);
+    for (u32 x = 0; x < w; ++x) {
+        const u32 a = ys[x > 0 ? x-1 : 0], b = ys[x], c = ys[x+1 < w ? x+1 : w-1];
+        const u32 lo = std::min({a, b, c}), hi = std::max({a, b, c});
+        for (u32 y = lo > 0 ? lo-1 : 0; y <= std::min(hi, h-1); ++y) row(e, y)[x] = energy_at(image, x, y);
+    }
+}
+
+u32 retarget(buffer_view<u8>& image, u32 target_width, u32 target_height, retarget_order order,
+             retarget_workspace& ws, carve_stats* stats)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    target_width = std::max(1u, std::min(target_width, width(image)));
+    target_height = std::max(1u, std::min(target_height, height(image)));
+    const u32 columns = width(image) - target_width, rows = height(image) - target_height;
+
+    reserve(ws, width(image), height(image));
+    buffer_view<f32> e{pixels(ws.energy), width(image), height(image), pitch(ws.energy), 1};
+    edge_detect(image, e);
+
+    while (width(image) > target_width || height(image) > target_height) {
+        const u32 v_done = columns - (width(image) - target_width);
+        const u32 h_done = rows - (height(image) - target_height);
+
+        // with both searched, the costs of the seams in ws.xs and ws.ys
+        b32 searched = 0;
+        f32 costs[2];
+
+        b32 vertical;
+        if (width(image) == target_width) {
+            vertical = 0;
+        } else if (height(image) == target_height) {
+            vertical = 1;
+        } else if (order == RETARGET_RATIO) {
+            // keep both directions the same fraction of the way done
+            vertical = (u64)v_done * rows <= (u64)h_done * columns;
+        } else {
+            // the lower energy per pixel, from the seams as they are now
+            costs[0] = vertical_seam(e, ws);
+            costs[1] = horizontal_seam(e, ws);
+            searched = 1;
+            vertical = costs[0] / height(image) <= costs[1] / width(image);
+        }
+
+        f32 cost;
+        if (vertical) {
+            cost = searched ? costs[0] : vertical_seam(e, ws);
+            remove_seam_columns(image, pixels(ws.xs));
+            remove_seam_columns(e, pixels(ws.xs));
+            set_width(image, width(image) - 1);
+            set_width(e, width(e) - 1);
+            update_vertical(image, e, pixels(ws.xs));
+        } else {
+            cost = searched ? costs[1] : horizontal_seam(e, ws);
+            remove_seam_rows(image, pixels(ws.ys));
+            remove_seam_rows(e, pixels(ws.ys));
+            set_height(image, height(image) - 1);
+            set_height(e, height(e) - 1);
+            update_horizontal(image, e, pixels(ws.ys));
+        }
+
+        if (stats) {
+            stats->seams++;
+            if (!vertical) stats->horizontal++;
+            stats->energy += cost;
+        }
+    }
+
+    if (stats) {
+        stats->seconds += std::chrono::duration<f32>(std::chrono::steady_clock::now() - start).count();
+    }
+    return width(image);
+}
@@ -0,0 +1,84 @@
+#include <algorithm>
+#include <cassert>
+
+#include "seam_order.hpp"
+
+seam_order::seam_order(const buffer_view<u8>& original, u32 min_width, seam_mode mode)
+    : image(copy(original)),
+      step{width(original), height(original), width(original), 1}
+{
+    std::fill(begin(step), end(step), ~0u);
+    worker = std::thread([this, min_width, mode] { find_seams(min_width, mode); });
+}
+
+seam_order::~seam_order()
+{
+    stop = true;
+    worker.join();
+}
+
+// Removes seams from an index map of the image, handing the original
+// columns of each over to the render thread.
+void seam_order::find_seams(u32 min_width, seam_mode mode)
+{
+    carve_workspace ws;
+    ws.mode = mode;
+    reserve(ws, width(image), height(image));
+
+    index_map<u32> m{view(image)};
+    std::vector<u32> removed(height(image));
+
+    while (width(m) > std::max(min_width, 1u) && !stop) {
+        remove_seam(m, ws, nullptr, removed.data());
+
+        std::lock_guard<std::mutex> guard(lock);
+        found.insert(found.end(), removed.begin(), removed.end());
+        found_seams++;
+    }
+}
+
+void seam_order::take_found()
+{
+    std::vector<u32> columns;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        columns.swap(found);
+    }
+
+    const u32 h = height(image);
+    for (size_t i = 0; i < columns.size(); i += h, ++seams) {
+        for (u32 y = 0; y < h; ++y) row(step, y)[columns[i + y]] = seams;
+    }
+}
+
+u32 seam_order::narrowest()
+{
+    return width(image) - found_seams;
+}
+
+u32 seam_order::render(u32 target_width, buffer_view<u8>& out)
+{
+    take_found();
+
+    const u32 w = std::max(target_width, width(image) - seams);
+    const u32 removed = width(image) - std::min(w, width(image));
+    const u32 s = bpp(image);
+    assert(bpp(out) == s);
+
+    // a pixel is shown while the seam that removes it is not, copied in
+    // runs between removed pixels
+    const u32 shown = std::min(w, width(out));
+    for (u32 y = 0; y < std::min(height(image), height(out)); ++y) {
+        const u8* src = row(image, y);
+        const u32* order = row(step, y);
+        u8* dst = row(out, y);
+        for (u32 x = 0, n = 0; n < shown;) {
+            u32 x1 = x;
+            while (x1 < x + shown - n && order[x1] >= removed) ++x1;
+            std::copy(src + x * s, src + x1 * s, dst + n * s);
+            n += x1 - x;
+            x = x1 + 1;
+        }
+    }
+    return std::min(w, width(image));
+}
@@ -0,0 +1,53 @@
+#ifndef SEAM_ORDER_HPP
+#define SEAM_ORDER_HPP
+
+// Order in which the seams of an image get removed, so the image can be
+// shown at any width between its own and min_width without carving
+// again. Widening back is only showing fewer seams.
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "types.hpp"
+#include "tbuffer.hpp"
+#include "seamcarve.hpp"
+
+class seam_order {
+public:
+    // Copies image and starts finding its seams on a background thread.
+    // Widths become available from the widest down as seams are found.
+    seam_order(const buffer_view<u8>& image, u32 min_width, seam_mode mode = SEAM_EXACT);
+    ~seam_order();
+
+    seam_order(const seam_order&) = delete;
+    seam_order& operator=(const seam_order&) = delete;
+
+    // Narrowest width that can be rendered right now.
+    u32 narrowest();
+
+    // Writes the image carved to target_width, or to the narrowest width
+    // found so far, to the top left of out and returns that width. Rows
+    // are cut to the width of out.
+    u32 render(u32 target_width, buffer_view<u8>& out);
+
+    friend inline u32 width(const seam_order& o) { return width(o.image); }
+    friend inline u32 height(const seam_order& o) { return height(o.image); }
+
+private:
+    void find_seams(u32 min_width, seam_mode mode);
+    void take_found();
+
+    buffer<u8> image;
+    buffer<u32> step;       // seam that removes each pixel, ~0u if none does
+    u32 seams = 0;          // seams in step
+
+    std::mutex lock;
+    std::vector<u32> found; // columns of seams not yet in step, one per row
+    std::atomic<u32> found_seams{0};
+    std::atomic<bool> stop{false};
+    std::thread worker;
+};
+
+#endif
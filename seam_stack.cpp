@@ -0,0 +1,133 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "seam_stack.hpp"
+#include "choice.hpp"
+
+// A record: x in the first row (u32), the moves between rows packed like
+// path choices, then the pixels of the seam from top to bottom.
+
+void seam_stack::push(const buffer_view<u8>& image, const u32* seam)
+{
+    if (height(image) != h || bpp(image) != s) {
+        h = height(image);
+        s = bpp(image);
+        bytes = sizeof(u32) + packed_view::row_bytes(h) + h * s;
+        capacity = budget / bytes;
+        records.clear();
+        xs.resize(h);
+        clear();
+    }
+    if (capacity == 0) return;
+
+    redone = 0;
+    if (count == capacity) {
+        first = (first + 1) % capacity;
+        count--;
+    }
+    if (records.size() < (size_t)(count + 1) * bytes) {
+        records.resize(std::min<size_t>(std::max<size_t>(2 * records.size(), bytes), capacity * bytes));
+    }
+
+    u8* r = record(count++);
+    memcpy(r, &seam[0], sizeof(u32));
+
+    packed_view moves{r + sizeof(u32), h, 1, packed_view::row_bytes(h)};
+    u8* p = r + sizeof(u32) + packed_view::row_bytes(h);
+    for (u32 y = 0; y < h; ++y) {
+        if (y > 0) {
+            assert(seam[y] + 1 >= seam[y-1] && seam[y] <= seam[y-1] + 1);
+            set_choice(moves, y, 0, seam[y] + 1 - seam[y-1]);
+        }
+        memcpy(p + y * s, row(image, y) + seam[y] * s, s);
+    }
+}
+
+void seam_stack::unpack(u8* r, u32* seam)
+{
+    memcpy(&seam[0], r, sizeof(u32));
+
+    packed_view moves{r + sizeof(u32), h, 1, packed_view::row_bytes(h)};
+    for (u32 y = 1; y < h; ++y) seam[y] = seam[y-1] + choice_at(moves, y, 0) - 1;
+}
+
+// Seam k of an undo goes back into the image with seams 0..k-1 already
+// back in it, moving those at or right of it along; seam k of a redo came
+// out of the image with 0..k-1 already gone, so it is moved right past
+// those at or left of it. Either way at[k] ends up as the column of seam k
+// in the wider image, and the row is shifted once, a run at a time.
+
+u32 seam_stack::undo(buffer_view<u8>& image, u32 n)
+{
+    n = std::min(n, count);
+    if (n == 0) return 0;
+    assert(height(image) == h && bpp(image) == s);
+    assert((width(image) + n) * s <= pitch(image));
+
+    xs.resize((size_t)n * h);
+    at.resize(n);
+    std::vector<const u8*> from(n);
+    for (u32 k = 0; k < n; ++k) unpack(record(count - 1 - k), &xs[(size_t)k * h]);
+
+    const u32 w = width(image);
+    std::vector<u32> order(n);
+    for (u32 y = 0; y < h; ++y) {
+        for (u32 k = 0; k < n; ++k) {
+            const u32 x = xs[(size_t)k * h + y];
+            for (u32 j = 0; j < k; ++j) at[j] += at[j] >= x;
+            at[k] = x;
+        }
+        for (u32 k = 0; k < n; ++k) order[k] = k;
+        std::sort(order.begin(), order.end(), [&](u32 a, u32 b) { return at[a] < at[b]; });
+
+        // from the right: the run after the i-th seam moves by i + 1
+        u8* i_row = row(image, y);
+        u32 end = w + n;
+        for (u32 i = n; i-- > 0;) {
+            const u32 k = order[i], x = at[k];
+            memmove(i_row + (x + 1) * s, i_row + (x - i) * s, (end - x - 1) * s);
+            const u8* p = record(count - 1 - k) + sizeof(u32) + packed_view::row_bytes(h);
+            memcpy(i_row + x * s, p + y * s, s);
+            end = x;
+        }
+    }
+    set_width(image, w + n);
+
+    count -= n;
+    redone += n;
+    return n;
+}
+
+u32 seam_stack::redo(buffer_view<u8>& image, u32 n)
+{
+    n = std::min(n, redone);
+    if (n == 0) return 0;
+    assert(height(image) == h && bpp(image) == s);
+
+    xs.resize((size_t)n * h);
+    at.resize(n);
+    for (u32 k = 0; k < n; ++k) unpack(record(count + k), &xs[(size_t)k * h]);
+
+    const u32 w = width(image);
+    for (u32 y = 0; y < h; ++y) {
+        for (u32 k = 0; k < n; ++k) {
+            u32 x = xs[(size_t)k * h + y];
+            for (u32 j = k; j-- > 0;) x += xs[(size_t)j * h + y] <= x;
+            at[k] = x;
+        }
+        std::sort(at.begin(), at.end());
+
+        // from the left: the run after the i-th seam moves by i + 1
+        u8* i_row = row(image, y);
+        for (u32 i = 0; i < n; ++i) {
+            const u32 end = i + 1 < n ? at[i + 1] : w;
+            memmove(i_row + (at[i] - i) * s, i_row + (at[i] + 1) * s, (end - at[i] - 1) * s);
+        }
+    }
+    set_width(image, w - n);
+
+    count += n;
+    redone -= n;
+    return n;
+}
@@ -0,0 +1,59 @@
+#ifndef SEAM_STACK_HPP
+#define SEAM_STACK_HPP
+
+// Removed seams, kept so they can be put back. Every seam is its x in the
+// first row, how it moves from row to row at two bits a row, and the
+// pixels it took out. When the seams no longer fit the budget the oldest
+// are dropped, they can't be put back any more.
+
+#include <cstddef>
+#include <vector>
+
+#include "types.hpp"
+#include "tbuffer.hpp"
+
+class seam_stack {
+public:
+    explicit seam_stack(size_t budget = 64 << 20) : budget(budget) {}
+
+    // Records the seam with the x of every row in xs, before it's removed
+    // from image. Forgets the seams that could be removed again.
+    void push(const buffer_view<u8>& image, const u32* xs);
+
+    // Puts the last n seams back into image, which grows by a column for
+    // each and needs the room in its pitch. They can be removed again with
+    // redo. Returns how many were put back, fewer when the stack runs out.
+    //
+    // Every row is shifted once per call, so a call costs O(W x H x bpp)
+    // plus O(n^2 x H) to place the seams: O(H x bpp) per seam only when
+    // n is in the order of the width. Putting seams back one at a time
+    // shifts the rows once per seam.
+    u32 undo(buffer_view<u8>& image, u32 n = 1);
+
+    // Removes the last n seams put back again, the same way. Returns how
+    // many it removed.
+    u32 redo(buffer_view<u8>& image, u32 n = 1);
+
+    void clear() { count = 0; redone = 0; first = 0; }
+
+    friend inline u32 undo_count(const seam_stack& s) { return s.count; }
+    friend inline u32 redo_count(const seam_stack& s) { return s.redone; }
+    friend inline size_t record_bytes(const seam_stack& s) { return s.bytes; }
+
+private:
+    u8* record(u32 i) { return records.data() + ((first + i) % capacity) * bytes; }
+    void unpack(u8* r, u32* xs);
+
+    size_t budget;
+    u32 h = 0, s = 0;       // height and bpp of the image the seams came from
+    size_t bytes = 0;       // per seam
+    u32 capacity = 0;       // seams that fit the budget
+    u32 first = 0;          // oldest seam in records, which is a ring
+    u32 count = 0;          // seams that can be put back
+    u32 redone = 0;         // seams after those that can be removed again
+    std::vector<u8> records;
+    std::vector<u32> xs;    // the x of every row of the seams of one call
+    std::vector<u32> at;    // where they are in the wider image, for a row
+};
+
+#endif
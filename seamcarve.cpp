@@ -0,0 +1,593 @@
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "carve.hpp"
+#include "profile.hpp"
+#include "resample.hpp"
+
+const char* seam_mode_name(seam_mode mode)
+{
+    return mode == SEAM_EXACT ? "exact" : "greedy";
+}
+
+int parse_seam_mode(const char* name, seam_mode* mode)
+{
+    if (!strcmp(name, "exact")) *mode = SEAM_EXACT;
+    else if (!strcmp(name, "greedy")) *mode = SEAM_GREEDY;
+    else return 1;
+    return 0;
+}
+
+static u32 checkpoint_interval(u32 h)
+{
+    return std::max(1u, (u32)std::ceil(std::sqrt((f32)h)));
+}
+
+static u32 choice_pitch(choice_storage storage, u32 w)
+{
+    switch (storage) {
+        case CHOICE_BYTES: return w;
+        case CHOICE_PACKED: return packed_view::row_bytes(w);
+        case CHOICE_NONE: return 0;
+    }
+    return w;
+}
+
+f32 scratch_per_pixel(choice_storage storage, seam_mode mode)
+{
+    // greedy seams keep the energies of the whole image
+    const f32 energies = mode == SEAM_GREEDY ? sizeof(f32) : 0;
+    switch (storage) {
+        case CHOICE_BYTES: return energies + 1;
+        case CHOICE_PACKED: return energies + 0.25f;
+        case CHOICE_NONE: return energies;
+    }
+    return 0;
+}
+
+void reserve(carve_workspace& ws, u32 w, u32 h)
+{
+    if (w > ws.w || h > ws.h) {
+        ws.w = std::max(w, ws.w);
+        ws.h = std::max(h, ws.h);
+        ws.sums = buffer<f32>{ws.w, 1, ws.w, 1};
+    }
+
+    w = ws.w;
+    h = ws.h;
+
+    if (ws.mode == SEAM_GREEDY && (w != width(ws.edges) || h != height(ws.edges))) {
+        ws.edges = buffer<f32>{w, h, padded_pitch(w, sizeof(f32)), 1};
+    }
+
+    const u32 cp = choice_pitch(ws.storage, w);
+    if (cp != width(ws.choice) || h != height(ws.choice)) {
+        ws.choice = cp ? buffer<u8>{cp, h, padded_pitch(cp, 1), 1} : buffer<u8>{};
+    }
+
+    if (h != height(ws.seam)) {
+        ws.seam = buffer<u32>{1, h, 1, 1};
+    }
+
+    if (ws.mode != SEAM_EXACT) return;
+
+    // without a table, cost rows are checkpointed every k rows and the
+    // choices between two checkpoints recomputed while backtracking
+    const u32 k = checkpoint_interval(h);
+    const u32 rows = ws.storage == CHOICE_NONE ? 2 + (h + k - 1) / k : 2;
+    if (w != width(ws.costs) || rows != height(ws.costs)) {
+        ws.costs = buffer<f32>{w, rows, w, 1};
+    }
+    if (w != width(ws.segment) || k != height(ws.segment)) {
+        ws.segment = buffer<u8>{w, k, w, 1};
+    }
+}
+
+static void set_choices(buffer_view<u8>& table, u32 y, const u8* c)
+{
+    std::copy_n(c, width(table), row(table, y));
+}
+
+static void set_choices(packed_view& table, u32 y, const u8* c)
+{
+    pack_row(table, y, c);
+}
+
+// Energies of one row at a time straight from the pixels, protected
+// columns at infinity. Exact seams fold each row into the costs as soon as
+// it is computed, so no energies of the whole image are kept.
+template <typename B>
+struct row_energy {
+    const B& image;
+    u32 left, right;
+
+    void operator()(u32 y, f32* e) const
+    {
+        energy_row(image, y, e);
+        if (left || right) protect_row(e, width(image), left, right);
+    }
+};
+
+// Exact seam: the cheapest cumulative cost in the last row, followed back
+// up through the choices. Fills ws.seam with the x of every row.
+template <typename B, typename C>
+static void exact_seam(const row_energy<B>& energy, C& table, carve_workspace& ws, f32* cost)
+{
+    const u32 w = width(energy.image), h = height(energy.image);
+    f32* prev = row(ws.costs, 0);
+    f32* cur = row(ws.costs, 1);
+    f32* e = pixels(ws.sums);
+    u8* c = row(ws.segment, 0);
+    u32* xs = pixels(ws.seam);
+
+    {
+        stage_scope stage(ws.profile, STAGE_COSTS, (u64)w * h);
+        energy(0, prev);
+        for (u32 y = 1; y < h; ++y) {
+            energy(y, e);
+            cost_row(prev, e, cur, c, w);
+            set_choices(table, y, c);
+            std::swap(prev, cur);
+        }
+    }
+
+    stage_scope stage(ws.profile, STAGE_TRACE, (u64)w * h);
+    u32 x = std::min_element(prev, prev + w) - prev;
+    if (cost) *cost = prev[x];
+
+    for (u32 y = h; y-- > 0;) {
+        xs[y] = x;
+        if (y > 0) x = x + choice_at(table, x, y) - 1;
+    }
+}
+
+// Exact seam without a choice table, in O(sqrt(h) * w) memory. The
+// energies of a segment are computed again while backtracking.
+template <typename B>
+static void exact_seam_checkpointed(const row_energy<B>& energy, carve_workspace& ws, f32* cost)
+{
+    const u32 w = width(energy.image), h = height(energy.image);
+    const u32 k = checkpoint_interval(h);
+    f32* prev = row(ws.costs, 0);
+    f32* cur = row(ws.costs, 1);
+    f32* e = pixels(ws.sums);
+    u32* xs = pixels(ws.seam);
+
+    // checkpoint s is the cost row just above segment s
+    auto checkpoint = [&](u32 s) { return row(ws.costs, 2 + s); };
+
+    {
+        stage_scope stage(ws.profile, STAGE_COSTS, (u64)w * h);
+        energy(0, prev);
+        for (u32 y = 1; y < h; ++y) {
+            if (y % k == 0) std::copy_n(prev, w, checkpoint(y / k));
+            energy(y, e);
+            cost_row(prev, e, cur, row(ws.segment, 0), w);
+            std::swap(prev, cur);
+        }
+    }
+
+    // the segments are computed again while tracing, they count to it
+    stage_scope stage(ws.profile, STAGE_TRACE, (u64)w * h);
+    u32 x = std::min_element(prev, prev + w) - prev;
+    if (cost) *cost = prev[x];
+
+    for (u32 s = (h - 1) / k + 1; s-- > 0;) {
+        const u32 y0 = s * k, y1 = std::min(h, y0 + k);
+
+        // choices of the segment, from its checkpoint
+        if (s == 0) {
+            energy(0, prev);
+        } else {
+            energy(y0, e);
+            cost_row(checkpoint(s), e, prev, row(ws.segment, 0), w);
+        }
+        for (u32 y = y0 + 1; y < y1; ++y) {
+            energy(y, e);
+            cost_row(prev, e, cur, row(ws.segment, y - y0), w);
+            std::swap(prev, cur);
+        }
+
+        for (u32 y = y1; y-- > y0;) {
+            xs[y] = x;
+            if (y > 0) x = x + row(ws.segment, y - y0)[x] - 1;
+        }
+    }
+}
+
+// Follows the greedy choices down from x, filling ws.seam.
+template <typename C>
+static void trace_seam(const C& c, u32 x, u32 h, carve_workspace& ws)
+{
+    u32* xs = pixels(ws.seam);
+    for (u32 y = 0; y < h; ++y) {
+        xs[y] = x;
+        x = next_x(x, choice_at(c, x, y), width(c));
+    }
+}
+
+template <typename C>
+static void greedy_seam(const buffer_view<f32>& e, const C& c, carve_workspace& ws, f32* cost)
+{
+    stage_scope stage(ws.profile, STAGE_TRACE, (u64)width(e) * height(e));
+    trace_seam(c, find_minimum_path(e, c, pixels(ws.sums), cost), height(e), ws);
+}
+
+// Finds the seam in image, which holds pixels or goes through an index
+// map, leaves the x of every row in ws.seam. Greedy seams need the
+// energies of the whole image first, exact ones stream them row by row.
+template <typename B>
+static void find_seam_in(const B& image, carve_workspace& ws, f32* cost, u32 left, u32 right)
+{
+    const u32 w = width(image), h = height(image);
+
+    // callers switch ws.mode and ws.storage between seams, the buffers
+    // follow here; only compares when nothing changed
+    reserve(ws, w, h);
+
+    if (ws.mode == SEAM_EXACT) {
+        row_energy<B> energy{image, left, right};
+        switch (ws.storage) {
+            case CHOICE_BYTES: {
+                buffer_view<u8> c{pixels(ws.choice), w, h, pitch(ws.choice), 1};
+                exact_seam(energy, c, ws, cost);
+                break;
+            }
+            case CHOICE_PACKED: {
+                packed_view c{pixels(ws.choice), w, h, pitch(ws.choice)};
+                exact_seam(energy, c, ws, cost);
+                break;
+            }
+            case CHOICE_NONE:
+                exact_seam_checkpointed(energy, ws, cost);
+                break;
+        }
+        return;
+    }
+
+    buffer_view<f32> e{pixels(ws.edges), w, h, pitch(ws.edges), 1};
+    {
+        stage_scope stage(ws.profile, STAGE_ENERGY, (u64)w * h);
+        edge_detect(image, e);
+        if (left || right) protect_columns(e, left, right);
+    }
+
+    switch (ws.storage) {
+        case CHOICE_BYTES: {
+            buffer_view<u8> c{pixels(ws.choice), w, h, pitch(ws.choice), 1};
+            {
+                stage_scope stage(ws.profile, STAGE_COSTS, (u64)w * h);
+                calculate_paths(e, c);
+            }
+            greedy_seam(e, c, ws, cost);
+            break;
+        }
+        case CHOICE_PACKED: {
+            packed_view c{pixels(ws.choice), w, h, pitch(ws.choice)};
+            {
+                stage_scope stage(ws.profile, STAGE_COSTS, (u64)w * h);
+                calculate_paths(e, c);
+            }
+            greedy_seam(e, c, ws, cost);
+            break;
+        }
+        case CHOICE_NONE: {
+            recomputed_choice<buffer_view<f32>> c{e};
+            greedy_seam(e, c, ws, cost);
+            break;
+        }
+    }
+}
+
+void find_seam(const buffer_view<u8>& image, carve_workspace& ws, f32* cost, u32 left, u32 right)
+{
+    find_seam_in(image, ws, cost, left, right);
+}
+
+void remove_seam(buffer_view<u8>& image, const u32* xs)
+{
+    remove_seam_columns(image, xs);
+
+    // decrease width of the view (pitch stays the same)
+    set_width(image, width(image)-1);
+}
+
+u32 remove_seam(buffer_view<u8>& image, carve_workspace& ws, f32* cost, u32 left, u32 right)
+{
+    find_seam(image, ws, cost, left, right);
+    stage_scope stage(ws.profile, STAGE_REMOVE, (u64)width(image) * height(image));
+    remove_seam(image, pixels(ws.seam));
+    return pixels(ws.seam)[0];
+}
+
+template <typename I>
+static u32 remove_lazy_seam(index_map<I>& image, carve_workspace& ws, f32* cost, u32* removed)
+{
+    find_seam_in(image, ws, cost, 0, 0);
+
+    const u32* xs = pixels(ws.seam);
+    stage_scope stage(ws.profile, STAGE_REMOVE, (u64)width(image) * height(image));
+    if (removed) {
+        for (u32 y = 0; y < height(image); ++y) removed[y] = row(image.index, y)[xs[y]];
+    }
+    remove_seam_columns(image.index, xs);
+
+    set_width(image.index, width(image)-1);
+    return xs[0];
+}
+
+u32 remove_seam(index_map<u16>& image, carve_workspace& ws, f32* cost, u32* removed)
+{
+    return remove_lazy_seam(image, ws, cost, removed);
+}
+
+u32 remove_seam(index_map<u32>& image, carve_workspace& ws, f32* cost, u32* removed)
+{
+    return remove_lazy_seam(image, ws, cost, removed);
+}
+
+template <typename B>
+static u32 carve_image(B& image, u32 target_width, carve_workspace& ws, carve_stats* stats)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    reserve(ws, width(image), height(image));
+
+    while (width(image) > std::max(target_width, 1u)) {
+        f32 cost = 0;
+        remove_seam(image, ws, &cost);
+        if (stats) {
+            stats->seams++;
+            stats->energy += cost;
+        }
+    }
+
+    if (stats) {
+        stats->seconds += std::chrono::duration<f32>(std::chrono::steady_clock::now() - start).count();
+    }
+    return width(image);
+}
+
+u32 carve(buffer_view<u8>& image, u32 target_width, carve_workspace& ws, carve_stats* stats)
+{
+    return carve_image(image, target_width, ws, stats);
+}
+
+u32 carve_within(buffer_view<u8>& image, u32 target_width, f32 seconds, carve_workspace& ws, carve_stats* stats)
+{
+    typedef std::chrono::steady_clock clock;
+    const auto start = clock::now();
+    const auto deadline = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<f32>(seconds));
+
+    target_width = std::max(target_width, 1u);
+    reserve(ws, width(image), height(image));
+
+    // the resample of whatever is left is timed on a few rows up front and
+    // kept back; it gets cheaper as the image narrows, so this estimate
+    // holds for the whole carve
+    clock::duration resample{0};
+    if (width(image) > target_width) {
+        const u32 s = bpp(image), rows = std::min(height(image), 16u);
+        buffer<u8> scratch{target_width * s, rows, target_width * s, 1};
+        buffer_view<u8> in{pixels(image), width(image), rows, pitch(image), s};
+        buffer_view<u8> out{pixels(scratch), target_width, rows, target_width * s, s};
+        const auto t = clock::now();
+        resample_rows(in, out);
+        resample = (clock::now() - t) * height(image) / rows;
+    }
+
+    // a seam is only started when the last one and the resample would
+    // still fit, seams get cheaper as the image narrows
+    clock::duration last{0};
+    while (width(image) > target_width) {
+        const auto t = clock::now();
+        if (t + last + resample > deadline) break;
+
+        f32 cost = 0;
+        remove_seam(image, ws, &cost);
+        last = clock::now() - t;
+        if (stats) {
+            stats->seams++;
+            stats->energy += cost;
+        }
+    }
+
+    if (width(image) > target_width) {
+        if (stats) stats->resampled += width(image) - target_width;
+        resample_width(image, target_width);
+    }
+
+    if (stats) {
+        stats->seconds += std::chrono::duration<f32>(clock::now() - start).count();
+    }
+    return width(image);
+}
+
+u32 carve_hybrid(buffer_view<u8>& image, u32 target_width, const hybrid_split& split, carve_workspace& ws,
+                 carve_stats* stats)
+{
+    target_width = std::max(target_width, 1u);
+    if (target_width >= width(image)) return width(image);
+
+    const f32 fraction = std::min(1.0f, std::max(0.0f, split.carved));
+    const u32 seams = (u32)std::lround(fraction * (width(image) - target_width));
+
+    auto resample = [&](u32 w) {
+        auto start = std::chrono::steady_clock::now();
+        if (stats) stats->resampled += width(image) - w;
+        resample_width(image, w);
+        if (stats) stats->seconds += std::chrono::duration<f32>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    if (split.carve_first) {
+        carve(image, width(image) - seams, ws, stats);
+        resample(target_width);
+    } else {
+        resample(target_width + seams);
+        carve(image, target_width, ws, stats);
+    }
+    return width(image);
+}
+
+u32 carve(index_map<u16>& image, u32 target_width, carve_workspace& ws, carve_stats* stats)
+{
+    return carve_image(image, target_width, ws, stats);
+}
+
+u32 carve(index_map<u32>& image, u32 target_width, carve_workspace& ws, carve_stats* stats)
+{
+    return carve_image(image, target_width, ws, stats);
+}
+
+template <typename I>
+static u32 carve_targets_lazy(buffer_view<u8>& image, const std::vector<u32>& targets,
+                              carve_workspace& ws, const emit_fn& emit, carve_stats* stats)
+{
+    index_map<I> m{image};
+    buffer<u8> out{width(image), height(image), width(image) * bpp(image), bpp(image)};
+
+    for (u32 target : targets) {
+        carve(m, target, ws, stats);
+
+        buffer_view<u8> v{pixels(out), width(m), height(m), pitch(out), bpp(out)};
+        materialize(m, v);
+        emit(v, target);
+    }
+
+    // pixels only move once, at the end
+    materialize(m, image);
+    set_width(image, width(m));
+    return width(image);
+}
+
+u32 carve_targets(buffer_view<u8>& image, std::vector<u32> targets, carve_workspace& ws, const emit_fn& emit,
+                  carve_stats* stats)
+{
+    std::sort(targets.begin(), targets.end(), std::greater<u32>());
+
+    if (width(image) <= 0xffff) return carve_targets_lazy<u16>(image, targets, ws, emit, stats);
+    return carve_targets_lazy<u32>(image, targets, ws, emit, stats);
+}
+
+u32 carve_region(buffer<u8>& image, u32 x, u32 y, u32 w, u32 h, u32 seams, carve_workspace& ws)
+{
+    buffer_view<u8> region{image, x, y, w, h};
+    return carve(region, w > seams ? w - seams : 1, ws);
+}
+
+u32 carve_strips(buffer<u8>& image, u32 seams, u32 strips, u32 margin, strip_report* report)
+{
+    const u32 w = width(image);
+    const u32 h = height(image);
+    const u32 s = bpp(image);
+
+    strips = std::max<u32>(1, std::min<u32>(strips, w / 4));
+
+    struct strip {
+        u32 x0, x1;      // core columns in the image
+        u32 ml, mr;      // margins
+        u32 left, right; // columns seams stay out of
+        u32 room;        // seams that fit between them
+        u32 seams;       // share of the seams
+        f32 cost;
+        buffer<u8> pixels;
+    };
+    std::vector<strip> parts(strips);
+
+    u32 assigned = 0, shortfall = 0;
+    for (u32 i = 0; i < strips; ++i) {
+        strip& p = parts[i];
+        p.x0 = u64(w) * i / strips;
+        p.x1 = u64(w) * (i+1) / strips;
+        p.ml = std::min(margin, p.x0);
+        p.mr = std::min(margin, w - p.x1);
+
+        // margins and boundary columns next to a neighbouring strip
+        p.left = p.x0 > 0 ? p.ml + 1 : 0;
+        p.right = p.x1 < w ? p.mr + 1 : 0;
+        const u32 sw = p.ml + (p.x1 - p.x0) + p.mr;
+        p.room = sw > p.left + p.right + 1 ? sw - p.left - p.right - 1 : 0;
+
+        const u32 share = u64(seams) * p.x1 / w - assigned;
+        assigned += share;
+        p.seams = std::min(share, p.room);
+        shortfall += share - p.seams;
+        p.cost = 0;
+
+        p.pixels = buffer<u8>{sw, h, sw * s, s};
+        for (u32 y = 0; y < h; ++y) {
+            std::copy_n(row(image, y) + (p.x0 - p.ml) * s, sw * s, row(p.pixels, y));
+        }
+    }
+
+    // what narrow strips can't take goes to the others, one at a time
+    // so it spreads over the width
+    for (b32 more = 1; shortfall && more;) {
+        more = 0;
+        for (auto& p : parts) {
+            if (shortfall && p.seams < p.room) {
+                p.seams++;
+                shortfall--;
+                more = 1;
+            }
+        }
+    }
+
+    std::vector<std::thread> threads;
+    for (auto& p : parts) {
+        threads.emplace_back([&p] {
+            const u32 sw = width(p.pixels), h = height(p.pixels);
+            carve_workspace ws;
+            reserve(ws, sw, h);
+            buffer_view<u8> v = view(p.pixels);
+
+            for (u32 i = 0; i < p.seams; ++i) {
+                f32 cost = 0;
+                remove_seam(v, ws, &cost, p.left, p.right);
+                p.cost += cost;
+            }
+            set_width(p.pixels, width(v));
+        });
+    }
+    for (auto& t : threads) t.join();
+
+    // stitch: the core of every strip, minus what was carved from it
+    buffer<u8> original;
+    if (report && report->compare) original = image;
+
+    for (u32 y = 0; y < h; ++y) {
+        u8* dst = row(image, y);
+        for (auto& p : parts) {
+            const u32 core = width(p.pixels) - p.ml - p.mr;
+            dst = std::copy_n(row(p.pixels, y) + p.ml * s, core * s, dst);
+        }
+    }
+
+    u32 removed = 0;
+    for (auto& p : parts) removed += p.seams;
+    set_width(image, w - removed);
+
+    if (!report) return removed;
+
+    report->strips = strips;
+    report->seams = removed;
+    report->strip_cost = 0;
+    for (auto& p : parts) report->strip_cost += p.cost;
+    report->global_cost = 0;
+    if (!report->compare) return removed;
+
+    // cost of the same number of seams carved over the whole width, as
+    // long again as a serial carve
+    carve_workspace ws;
+    reserve(ws, w, h);
+    buffer_view<u8> v = view(original);
+    for (u32 i = 0; i < removed; ++i) {
+        f32 cost = 0;
+        remove_seam(v, ws, &cost);
+        report->global_cost += cost;
+    }
+    return removed;
+}
@@ -0,0 +1,186 @@
+#ifndef SEAMCARVE_HPP
+#define SEAMCARVE_HPP
+
+// libseamcarve: seam carving on 8-bit images
+//
+// All state lives in the image and the caller-owned workspace, so
+// different threads can carve at the same time with their own workspace.
+
+#include <functional>
+#include <vector>
+
+#include "types.hpp"
+#include "tbuffer.hpp"
+#include "index_map.hpp"
+
+class carve_profile;
+
+// How the path choices are kept while a seam is found:
+// a byte per pixel, two bits per pixel, or not at all and recomputed
+// from the energies when a path is followed.
+enum choice_storage {
+    CHOICE_BYTES,
+    CHOICE_PACKED,
+    CHOICE_NONE,
+};
+
+// How seams are found:
+// greedy follows, from every top pixel, the cheapest of the three
+// energies around it in the row above and keeps the path with the
+// smallest sum. Exact finds the seam of the smallest total energy with
+// cumulative costs from the top.
+enum seam_mode {
+    SEAM_GREEDY,
+    SEAM_EXACT,
+};
+
+const char* seam_mode_name(seam_mode mode);
+
+// SEAM_EXACT for "exact", SEAM_GREEDY for "greedy", returns 0 on success.
+int parse_seam_mode(const char* name, seam_mode* mode);
+
+// Scratch memory for carving images up to a given size. Reusing one
+// workspace for many carves avoids allocating per image.
+struct carve_workspace {
+    u32 w = 0, h = 0;       // largest image reserved for
+    buffer<f32> edges;      // greedy: energies of the whole image
+    buffer<u8> choice;
+    buffer<f32> sums;       // greedy: path sums, exact: one row of energies
+    buffer<f32> costs;      // exact: two rows, then checkpoints without a table
+    buffer<u8> segment;     // exact without a table: choices between checkpoints
+    buffer<u32> seam;       // x of the last seam in every row
+    choice_storage storage = CHOICE_PACKED;
+    seam_mode mode = SEAM_EXACT;
+    carve_profile* profile = nullptr;   // counts the stages of every seam when set, see profile.hpp
+};
+
+// What a carve did.
+struct carve_stats {
+    u32 seams = 0;
+    f64 energy = 0;     // sum of the energies of the removed pixels
+    f32 seconds = 0;
+    u32 resampled = 0;  // columns taken out by resampling instead of seams
+    u32 horizontal = 0; // seams of retarget that took out a row
+};
+
+// Bytes of scratch memory per pixel for a storage and mode, not counting
+// the rows exact seams keep.
+f32 scratch_per_pixel(choice_storage storage, seam_mode mode = SEAM_EXACT);
+
+// Makes ws large enough for images of w x h pixels, keeps it when it
+// already is.
+void reserve(carve_workspace& ws, u32 w, u32 h);
+
+// Removes one vertical seam from image, returns the x where it starts.
+// The first `left` and last `right` columns are never removed, the
+// energy of the seam goes to cost.
+u32 remove_seam(buffer_view<u8>& image, carve_workspace& ws,
+                f32* cost = nullptr, u32 left = 0, u32 right = 0);
+
+// The seam remove_seam would remove, left in ws.seam as the x of every
+// row, and its removal in two steps, for callers that look at it first.
+void find_seam(const buffer_view<u8>& image, carve_workspace& ws,
+               f32* cost = nullptr, u32 left = 0, u32 right = 0);
+void remove_seam(buffer_view<u8>& image, const u32* xs);
+
+// Same on an index map: only the indices move. removed, when given, gets
+// the column of the original removed in every row.
+u32 remove_seam(index_map<u16>& image, carve_workspace& ws, f32* cost = nullptr, u32* removed = nullptr);
+u32 remove_seam(index_map<u32>& image, carve_workspace& ws, f32* cost = nullptr, u32* removed = nullptr);
+
+// Carves image down to target_width, returns the new width. image may be
+// a sub-rectangle of a larger buffer, only the pixels inside it move.
+// Adds to stats when given.
+u32 carve(buffer_view<u8>& image, u32 target_width, carve_workspace& ws, carve_stats* stats = nullptr);
+u32 carve(index_map<u16>& image, u32 target_width, carve_workspace& ws, carve_stats* stats = nullptr);
+u32 carve(index_map<u32>& image, u32 target_width, carve_workspace& ws, carve_stats* stats = nullptr);
+
+// Carves image down to target_width within a time budget of `seconds`:
+// seams are removed while the next one and the resample of the rest are
+// expected to fit, then the rest of the width is resampled. The resample
+// is timed on a few rows first. Goes over the budget by at most the time
+// of one seam, unless the budget is too small for the resample alone.
+// Returns the new width, always target_width (or 1).
+u32 carve_within(buffer_view<u8>& image, u32 target_width, f32 seconds, carve_workspace& ws,
+                 carve_stats* stats = nullptr);
+
+// How carve_hybrid splits a reduction: the fraction `carved` of the
+// columns to remove goes by seams, the rest by resampling, which comes
+// first unless carve_first.
+struct hybrid_split {
+    f32 carved = 0.25f;
+    b32 carve_first = 0;
+};
+
+// Carves image down to target_width partly by resampling, see
+// hybrid_split. Returns the new width.
+u32 carve_hybrid(buffer_view<u8>& image, u32 target_width, const hybrid_split& split, carve_workspace& ws,
+                 carve_stats* stats = nullptr);
+
+// Which direction retarget carves next: the one whose next seam has the
+// lower energy per pixel, which searches both every step, or both at the
+// same pace.
+enum retarget_order {
+    RETARGET_CHEAPEST,
+    RETARGET_RATIO,
+};
+
+// Scratch memory of retarget: one energy map shared by both directions,
+// a packed choice table and a seam for each, and the rows the cost
+// search uses.
+struct retarget_workspace {
+    static const u32 BLOCK = 16;    // energy columns gathered at a time
+
+    buffer<f32> energy;
+    buffer<u8> vertical;
+    buffer<u8> horizontal;
+    buffer<f32> costs;
+    buffer<u8> choices;
+    buffer<u32> xs;     // vertical seam, x of each row
+    buffer<u32> ys;     // horizontal seam, y of each column
+};
+
+void reserve(retarget_workspace& ws, u32 w, u32 h);
+
+// Carves image down to target_width x target_height with exact seams in
+// both directions, picking the direction of each seam by order. The image
+// keeps its pitch, rows below the new height are left as they were.
+// Returns the new width; stats counts horizontal seams apart.
+u32 retarget(buffer_view<u8>& image, u32 target_width, u32 target_height, retarget_order order,
+             retarget_workspace& ws, carve_stats* stats = nullptr);
+
+// Called with the image each time a carve passes one of its targets.
+// The view is only valid during the call, copy what needs to be kept.
+typedef std::function<void(const buffer_view<u8>& image, u32 target)> emit_fn;
+
+// Carves image down to each of the target widths in one run, calling emit
+// as soon as the image reaches a target and carving on after it returns.
+// Targets come out from wide to narrow; those at or above the width of
+// image are emitted right away. Seams are removed from an index map, so
+// pixels are only copied for the outputs. Returns the final width.
+u32 carve_targets(buffer_view<u8>& image, std::vector<u32> targets, carve_workspace& ws, const emit_fn& emit,
+                  carve_stats* stats = nullptr);
+
+// Carves seams out of the rectangle (x, y, w, h) of image, leaving the
+// rest of the image untouched. Returns the new width of the rectangle.
+u32 carve_region(buffer<u8>& image, u32 x, u32 y, u32 w, u32 h, u32 seams, carve_workspace& ws);
+
+struct strip_report {
+    b32 compare = 0;        // set to also carve the whole width for global_cost
+    u32 strips = 0;
+    u32 seams = 0;
+    f32 strip_cost = 0;     // energy removed by the strips
+    f32 global_cost = 0;    // energy removed by a global carve of the same image
+};
+
+// Carves `seams` seams out of very wide images by splitting them into
+// vertical strips that are carved on separate threads. Each strip carries
+// `margin` columns of its neighbours for the energy, and seams stay out of
+// the margins and the columns at the boundary, so stitching the strips
+// back together keeps the original pixels next to each other. A strip
+// too narrow for its share leaves the rest to the others. Returns the
+// number of seams removed, fewer than `seams` only when all strips are
+// down to their boundary columns.
+u32 carve_strips(buffer<u8>& image, u32 seams, u32 strips, u32 margin, strip_report* report = nullptr);
+
+#endif
@@ -2,6 +2,9 @@
 #define TBUFFER_HPP
 
 #include <algorithm>
+#include <new>
+
+#include "alloc.hpp"
 
 template <typename B>
 concept bool WriteBuffer = requires (B& b) {
@@ -27,51 +30,61 @@ concept bool ReadBuffer = requires (const B& b) {
 template <typename T>
 class buffer {
 public:
-     buffer() : data(0) {}
+     buffer() : w(0), h(0), p(0), s(0), data(0) {}
      buffer(u32 w, u32 h, u32 p, u32 s) :
-         w(w), h(h), p(p), s(s), data(new T[h*p]) {
+         w(w), h(h), p(p), s(s), data(allocate((size_t)h*p)) {
         auto first = data;
-        auto last = data + p * h;
+        auto last = data + (size_t)p * h;
         std::fill(first, last, 1);
     }
 
     buffer(const buffer& b) :
         w(b.w), h(b.h), p(b.p), s(b.s), data(nullptr)
     {
-        data = new T[h*p];
-        std::copy_n(b.data, h*p, data);
+        data = allocate((size_t)h*p);
+        std::copy_n(b.data, (size_t)h*p, data);
     }
 
     buffer& operator=(const buffer& b)
     {
-        T* tmp = new T[b.h*b.p];
-        std::copy_n(b.data, b.h*b.p, tmp);
+        T* tmp = allocate((size_t)b.h*b.p);
+        std::copy_n(b.data, (size_t)b.h*b.p, tmp);
         w = b.w;
         h = b.h;
         p = b.p;
         s = b.s;
+        free_bytes(data);
         data = tmp;
         return *this;
     }
 
-    buffer(buffer&& b) : w(b.w), h(b.h), p(b.p), data(b.data) {
+    buffer(buffer&& b) : w(b.w), h(b.h), p(b.p), s(b.s), data(b.data) {
         b.data = 0;
     }
     buffer& operator=(buffer&& b) {
         w = b.w;
         h = b.h;
         p = b.p;
-        data = b.data;
+        s = b.s;
+        std::swap(data, b.data);
         return *this;
     }
 
-    ~buffer() { delete [] data; }
+    ~buffer() { free_bytes(data); }
+
+    // pixels come from alloc_bytes, see alloc.hpp for the policy
+    static T* allocate(size_t n) {
+        T* d = (T*)alloc_bytes(n * sizeof(T));
+        if (!d) throw std::bad_alloc();
+        return d;
+    }
 
     friend constexpr inline u32 height(const buffer& b) { return b.h; }
     friend constexpr inline u32 width(const buffer& b) { return b.w; }
     friend constexpr inline u32 pitch(const buffer& b) { return b.p; }
     friend constexpr inline void set_pitch(buffer& b, u32 pitch) { b.p=pitch; }
     friend constexpr inline void set_width(buffer& b, u32 width) { b.w=width; }
+    friend constexpr inline void set_height(buffer& b, u32 height) { b.h=height; }
     friend constexpr inline u32 bpp(const buffer& b) { return b.s; }
 
 public:
@@ -88,7 +101,7 @@ template <typename U> inline
 U* begin(buffer<U>& b) { return pixels(b); }
 
 template <typename U> inline
-U* end(buffer<U>& b) { return pixels(b) + (pitch(b)*height(b)); }
+U* end(buffer<U>& b) { return pixels(b) + (size_t)pitch(b) * height(b); }
 
 template <typename U> inline
 U* pixels(buffer<U>& b) { return b.data; }
@@ -97,14 +110,16 @@ template <typename U> inline
 const U* pixels(const buffer<U>& b) { return b.data; }
 
 
-template <WriteBuffer B>          inline       typename B::value_type* row(B& b, u32 y) { return pixels(b) + y * pitch(b); }
-template <ReadBuffer B> constexpr inline const typename B::value_type* row(const B& b, u32 y) { return pixels(b) + y * pitch(b); }
+template <WriteBuffer B>          inline       typename B::value_type* row(B& b, u32 y) { return pixels(b) + (size_t)y * pitch(b); }
+template <ReadBuffer B> constexpr inline const typename B::value_type* row(const B& b, u32 y) { return pixels(b) + (size_t)y * pitch(b); }
 
 template <typename T>
 class buffer_view {
 public:
+    buffer_view() : w(0), h(0), p(0), s(0), pixels(nullptr) {}
+
     buffer_view(buffer<T>& b, u32 x, u32 y, u32 w, u32 h)
-        : w(w), h(h), p(pitch(b)), s(bpp(b)), pixels(row(b,y) + bpp(b) * x) {
+        : w(w), h(h), p(pitch(b)), s(bpp(b)), pixels(row(b,y) + (size_t)bpp(b) * x) {
     }
 
     buffer_view(T* pixels, u32 w, u32 h, u32 p, u32 s) :
@@ -113,8 +128,10 @@ public:
     friend constexpr inline u32 height(const buffer_view& b) { return b.h; }
     friend constexpr inline u32 width(const buffer_view& b) { return b.w; }
     friend constexpr inline u32 pitch(const buffer_view& b) { return b.p; }
+    friend constexpr inline void set_width(buffer_view& b, u32 width) { b.w=width; }
+    friend constexpr inline void set_height(buffer_view& b, u32 height) { b.h=height; }
     friend constexpr inline u32 bpp(const buffer_view& b) { return b.s; }
-    template <typename U> friend constexpr inline U* pixels(const buffer_view<U>& b) { return b.pixels; }
+    friend constexpr inline T* pixels(const buffer_view& b) { return b.pixels; }
 
 public:
     typedef T value_type;
@@ -124,9 +141,30 @@ private:
     u32 h;
     u32 p;
     u32 s; // bytes per pixel
-    u8* pixels;
+    T* pixels;
 };
 
+// sub-rectangle of a view, sharing its pixels
+template <typename T> inline
+buffer_view<T> view(const buffer_view<T>& b, u32 x, u32 y, u32 w, u32 h) {
+    return buffer_view<T>{pixels(b) + (size_t)y * pitch(b) + (size_t)x * bpp(b), w, h, pitch(b), bpp(b)};
+}
+
+template <typename T> inline
+buffer_view<T> view(buffer<T>& b) {
+    return buffer_view<T>{b, 0, 0, width(b), height(b)};
+}
+
+// packed copy of the pixels in a view
+template <typename T> inline
+buffer<T> copy(const buffer_view<T>& b) {
+    buffer<T> r{width(b), height(b), width(b) * bpp(b), bpp(b)};
+    for (u32 y = 0; y < height(b); ++y) {
+        std::copy_n(row(b, y), width(b) * bpp(b), row(r, y));
+    }
+    return r;
+}
+
 
 #endif
 
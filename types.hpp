@@ -0,0 +1,15 @@
+#ifndef TYPES_HPP
+#define TYPES_HPP
+
+#include <cstdint>
+
+typedef uint64_t u64;
+typedef uint32_t u32;
+typedef uint16_t u16;
+typedef int32_t  s32;
+typedef uint32_t b32;
+typedef uint8_t u8;
+typedef float f32;
+typedef double f64;
+
+#endif